@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include "cs1300bmp.h"
+#include "FilterApply.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "rdtsc.h"
+
+//
+// Times filters in this process, with no program to start and no
+// output to parse: each filter on each image with each variant of the
+// code, a few untimed runs first and then a number of timed ones. Only
+// applyFilter is timed; images are decoded once beforehand and nothing
+// is written.
+//
+
+//
+// One way of running the filters
+//
+struct Variant {
+  string name;
+  KernelPath path;
+  bool interleaved;
+  //
+  // 3x3 sums may use 16-bit lanes
+  //
+  bool narrow;
+};
+
+//
+// What the trials of one filter, image and variant took per pixel,
+// sorted
+//
+struct Result {
+  string filter;
+  string image;
+  string variant;
+  int width;
+  int height;
+  vector<double> cycles;
+  vector<double> nanoseconds;
+};
+
+//
+// The spread of a sorted set of trials, taken the way the filter
+// program takes it
+//
+static double
+percentile(const vector<double> &sorted, int percent)
+{
+  int n = sorted.size();
+  if ( percent == 50 ) {
+    return sorted[(n - 1) / 2];
+  }
+  return sorted[(n * percent + 99) / 100 - 1];
+}
+
+static void
+splitList(string list, vector<string> &items)
+{
+  string::size_type start = 0;
+  while ( start <= list.size() ) {
+    string::size_type comma = list.find(',', start);
+    if ( comma == string::npos ) {
+      comma = list.size();
+    }
+    if ( comma > start ) {
+      items.push_back(list.substr(start, comma - start));
+    }
+    start = comma + 1;
+  }
+}
+
+//
+// Every kernel path this CPU has on planar images, then the widest one
+// on interleaved images and with 32-bit sums only
+//
+static vector<Variant>
+allVariants()
+{
+  vector<Variant> variants;
+  KernelPath best = kernelPathDetect();
+  for (int path = 0; path <= best; path++) {
+    Variant variant = { kernelPathName((KernelPath) path), (KernelPath) path, false, true };
+    variants.push_back(variant);
+  }
+  Variant interleaved = { string(kernelPathName(best)) + "-interleaved", best, true, true };
+  Variant wide = { string(kernelPathName(best)) + "-wide", best, false, false };
+  variants.push_back(interleaved);
+  variants.push_back(wide);
+  return variants;
+}
+
+//
+// Pins this thread, and so the pool threads it starts, to COUNT of the
+// CPUs it may run on, from the FIRSTth
+//
+static void
+pinThreads(int first, int count)
+{
+  vector<int> allowed = ThreadPool::allowedCpus();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < count; i++) {
+    CPU_SET(allowed[(first + i) % allowed.size()], &set);
+  }
+  if ( sched_setaffinity(0, sizeof(set), &set) != 0 ) {
+    fprintf(stderr, "Could not pin to CPU %d; running unpinned\n", first);
+  }
+}
+
+static Result
+runTrials(Filter *filter, string filterName, string imageName, cs1300image *planar,
+	  cs1300packed *packed, const Variant &variant, int warmup, int trials)
+{
+  Result result;
+  result.filter = filterName;
+  result.image = imageName;
+  result.variant = variant.name;
+  result.width = planar -> width;
+  result.height = planar -> height;
+
+  cs1300image *output = cs1300image_new(0, 0);
+  cs1300packed *packedOutput = cs1300packed_new(0, 0);
+  cs1300view view;
+  cs1300packed_view(packed, &view);
+  kernelPath = variant.path;
+  kernelAllowNarrow(variant.narrow);
+  double pixels = (double) planar -> width * planar -> height;
+
+  for (int trial = -warmup; trial < trials; trial++) {
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    long long cycStart = rdtscll();
+    if ( variant.interleaved ) {
+      applyFilter(filter, &view, packedOutput);
+    } else {
+      applyFilter(filter, planar, output);
+    }
+    long long cycStop = rdtscll();
+    chrono::duration<double, nano> took = chrono::steady_clock::now() - started;
+    if ( trial >= 0 ) {
+      result.cycles.push_back((cycStop - cycStart) / pixels);
+      result.nanoseconds.push_back(took.count() / pixels);
+    }
+  }
+  sort(result.cycles.begin(), result.cycles.end());
+  sort(result.nanoseconds.begin(), result.nanoseconds.end());
+
+  cs1300image_delete(output);
+  cs1300packed_delete(packedOutput);
+  return result;
+}
+
+//
+// TEXT as a JSON string
+//
+static string
+quoted(const string &text)
+{
+  string out = "\"";
+  for (unsigned int i = 0; i < text.size(); i++) {
+    char c = text[i];
+    if ( c == '"' || c == '\\' ) {
+      out += '\\';
+      out += c;
+    } else if ( (unsigned char) c < 0x20 ) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out += escape;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static void
+writeJSON(const char *filename, const string &label, int threads, int warmup, int trials,
+	  vector<Result> &results)
+{
+  FILE *file = fopen(filename, "w");
+  if ( file == NULL ) {
+    fprintf(stderr, "Could not write %s\n", filename);
+    return;
+  }
+  fprintf(file, "{\n  \"label\": %s,\n  \"kernel\": \"%s\",\n  \"threads\": %d,\n"
+	  "  \"warmup\": %d,\n  \"trials\": %d,\n  \"results\": [\n",
+	  quoted(label).c_str(), kernelPathName(kernelPathDetect()), threads, warmup, trials);
+  for (unsigned int i = 0; i < results.size(); i++) {
+    Result &r = results[i];
+    fprintf(file, "    { \"filter\": %s, \"image\": %s, \"variant\": %s, "
+	    "\"width\": %d, \"height\": %d,\n"
+	    "      \"cycles_per_pixel\": { \"min\": %f, \"median\": %f, \"p95\": %f },\n"
+	    "      \"ns_per_pixel\": { \"min\": %f, \"median\": %f, \"p95\": %f } }%s\n",
+	    quoted(r.filter).c_str(), quoted(r.image).c_str(), quoted(r.variant).c_str(), r.width, r.height,
+	    r.cycles[0], percentile(r.cycles, 50), percentile(r.cycles, 95),
+	    r.nanoseconds[0], percentile(r.nanoseconds, 50), percentile(r.nanoseconds, 95),
+	    i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+}
+
+int
+main(int argc, char **argv)
+{
+  int trials = 10;
+  int warmup = 2;
+  int threads = 1;
+  //
+  // First CPU to pin to, or -1 to leave the threads where they fall
+  //
+  int cpu = 0;
+  string jsonFile;
+  string label;
+  vector<string> variantNames;
+  vector<string> filterNames;
+  vector<string> imageNames;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    char *end;
+    if ( arg.compare(0, 9, "--trials=") == 0 ) {
+      trials = strtol(arg.c_str() + 9, &end, 10);
+      if ( trials < 1 || *end != 0 || end == arg.c_str() + 9 ) {
+	fprintf(stderr, "Bad trial count %s\n", arg.c_str() + 9);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 9, "--warmup=") == 0 ) {
+      warmup = strtol(arg.c_str() + 9, &end, 10);
+      if ( warmup < 0 || *end != 0 || end == arg.c_str() + 9 ) {
+	fprintf(stderr, "Bad warmup count %s\n", arg.c_str() + 9);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 10, "--threads=") == 0 ) {
+      threads = strtol(arg.c_str() + 10, &end, 10);
+      if ( threads < 1 || *end != 0 || end == arg.c_str() + 10 ) {
+	fprintf(stderr, "Bad thread count %s\n", arg.c_str() + 10);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 6, "--cpu=") == 0 ) {
+      cpu = strtol(arg.c_str() + 6, &end, 10);
+      if ( cpu < -1 || *end != 0 || end == arg.c_str() + 6 ) {
+	fprintf(stderr, "Bad CPU %s\n", arg.c_str() + 6);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 7, "--json=") == 0 ) {
+      jsonFile = arg.substr(7);
+    } else if ( arg.compare(0, 8, "--label=") == 0 ) {
+      label = arg.substr(8);
+    } else if ( arg.compare(0, 11, "--variants=") == 0 ) {
+      splitList(arg.substr(11), variantNames);
+    } else if ( arg.compare(0, 2, "--") == 0 ) {
+      fprintf(stderr, "Unknown option %s\n", arg.c_str());
+      fprintf(stderr, "Usage: %s [--trials=N] [--warmup=N] [--threads=N] [--cpu=N|-1] [--json=FILE] [--label=TEXT] [--variants=a,b,...] [filter ...] [image.bmp ...]\n", argv[0]);
+      exit(-1);
+    } else if ( arg.find(".filter") != string::npos ) {
+      filterNames.push_back(arg);
+    } else {
+      imageNames.push_back(arg);
+    }
+  }
+
+  //
+  // The same filters and images as the Judge script by default
+  //
+  if ( filterNames.empty() ) {
+    splitList("gauss.filter,avg.filter,hline.filter,emboss.filter", filterNames);
+  }
+  if ( imageNames.empty() ) {
+    splitList("boats.bmp,blocks-small.bmp", imageNames);
+  }
+
+  vector<Variant> known = allVariants();
+  vector<Variant> variants;
+  if ( variantNames.empty() ) {
+    variants = known;
+  }
+  for (unsigned int v = 0; v < variantNames.size(); v++) {
+    unsigned int k = 0;
+    while ( k < known.size() && known[k].name != variantNames[v] ) {
+      k++;
+    }
+    if ( k == known.size() ) {
+      fprintf(stderr, "Unknown variant %s; this CPU has:", variantNames[v].c_str());
+      for (k = 0; k < known.size(); k++) {
+	fprintf(stderr, " %s", known[k].name.c_str());
+      }
+      fprintf(stderr, "\n");
+      exit(-1);
+    }
+    variants.push_back(known[k]);
+  }
+
+  if ( cpu >= 0 ) {
+    pinThreads(cpu, threads);
+  }
+  pool = new ThreadPool(threads);
+  reportFilters = false;
+
+  vector<Filter *> filters;
+  for (unsigned int f = 0; f < filterNames.size(); f++) {
+    filters.push_back(readFilter(filterNames[f]));
+  }
+
+  vector<Result> results;
+  for (unsigned int i = 0; i < imageNames.size(); i++) {
+    cs1300image *planar = cs1300image_new(0, 0);
+    cs1300packed *packed = cs1300packed_new(0, 0);
+    if ( ! cs1300image_readfile((char *) imageNames[i].c_str(), planar)
+	 || ! cs1300packed_readfile((char *) imageNames[i].c_str(), packed) ) {
+      fprintf(stderr, "Could not read %s\n", imageNames[i].c_str());
+      exit(-1);
+    }
+    for (unsigned int f = 0; f < filters.size(); f++) {
+      for (unsigned int v = 0; v < variants.size(); v++) {
+	Result result = runTrials(filters[f], filterNames[f], imageNames[i], planar, packed,
+				  variants[v], warmup, trials);
+	printf("%s %s %s: cycles per pixel min %.3f, median %.3f, p95 %.3f; ns per pixel median %.3f\n",
+	       result.filter.c_str(), result.image.c_str(), result.variant.c_str(),
+	       result.cycles[0], percentile(result.cycles, 50), percentile(result.cycles, 95),
+	       percentile(result.nanoseconds, 50));
+	results.push_back(result);
+      }
+    }
+    cs1300image_delete(planar);
+    cs1300packed_delete(packed);
+  }
+
+  //
+  // Like the Judge script, one figure per variant: the median over every
+  // filter and image of their medians
+  //
+  for (unsigned int v = 0; v < variants.size(); v++) {
+    vector<double> medians;
+    for (unsigned int r = 0; r < results.size(); r++) {
+      if ( results[r].variant == variants[v].name ) {
+	medians.push_back(percentile(results[r].cycles, 50));
+      }
+    }
+    sort(medians.begin(), medians.end());
+    printf("median CPE for %s is %.3f\n", variants[v].name.c_str(), percentile(medians, 50));
+  }
+
+  if ( ! jsonFile.empty() ) {
+    writeJSON(jsonFile.c_str(), label, threads, warmup, trials, results);
+  }
+  delete pool;
+  return 0;
+}
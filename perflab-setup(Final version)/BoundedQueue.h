@@ -0,0 +1,46 @@
+//-*-c++-*-
+#ifndef _BoundedQueue_h_
+#define _BoundedQueue_h_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+//
+// A first-in first-out queue between threads that holds at most a fixed
+// number of items: push waits while it is full and pop waits while it is
+// empty.
+//
+template <class T>
+class BoundedQueue {
+  deque<T> items;
+  size_t limit;
+  mutex lock;
+  condition_variable notFull;
+  condition_variable notEmpty;
+
+public:
+  BoundedQueue(size_t limit) : limit(limit) {}
+
+  void push(T item)
+  {
+    unique_lock<mutex> hold(lock);
+    notFull.wait(hold, [this] { return items.size() < limit; });
+    items.push_back(item);
+    notEmpty.notify_one();
+  }
+
+  T pop()
+  {
+    unique_lock<mutex> hold(lock);
+    notEmpty.wait(hold, [this] { return ! items.empty(); });
+    T item = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return item;
+  }
+};
+
+#endif
@@ -1,11 +1,18 @@
 #include "Filter.h"
 #include <iostream>
+#include <stdlib.h>
 
 Filter::Filter(int _dim)
 {
   divisor = 1;
   dim = _dim;
   data = new int[dim * dim];
+  separable = false;
+  box = false;
+  minSum = 0;
+  maxSum = 0;
+  rowFactor = new int[dim];
+  colFactor = new int[dim];
 }
 
 int Filter::get(int r, int c)
@@ -44,3 +51,111 @@ void Filter::info()
     cout << endl;
   }
 }
+
+static int gcd(int a, int b)
+{
+  a = abs(a);
+  b = abs(b);
+  while ( b != 0 ) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+void Filter::analyze()
+{
+  box = true;
+  for (int i = 1; i < dim * dim; i++) {
+    if ( data[i] != data[0] ) {
+      box = false;
+    }
+  }
+
+  minSum = 0;
+  maxSum = 0;
+  for (int i = 0; i < dim * dim; i++) {
+    if ( data[i] < 0 ) {
+      minSum += 255LL * data[i];
+    } else {
+      maxSum += 255LL * data[i];
+    }
+  }
+
+  //
+  // Separable: take the first nonzero row, divided by the gcd of its
+  // entries, as the row factor. If the filter is an outer product of
+  // integer vectors at all, every row is then an integer multiple of
+  // it, and those multiples are the column factor.
+  //
+  separable = false;
+
+  int pivotRow = -1, pivotCol = -1;
+  for (int r = 0; r < dim && pivotRow < 0; r++) {
+    for (int c = 0; c < dim; c++) {
+      if ( get(r, c) != 0 ) {
+	pivotRow = r;
+	pivotCol = c;
+	break;
+      }
+    }
+  }
+  if ( pivotRow < 0 ) {
+    return;
+  }
+
+  int g = 0;
+  for (int c = 0; c < dim; c++) {
+    g = gcd(g, get(pivotRow, c));
+  }
+  if ( get(pivotRow, pivotCol) < 0 ) {
+    g = -g;
+  }
+  for (int c = 0; c < dim; c++) {
+    rowFactor[c] = get(pivotRow, c) / g;
+  }
+
+  for (int r = 0; r < dim; r++) {
+    if ( get(r, pivotCol) % rowFactor[pivotCol] != 0 ) {
+      return;
+    }
+    colFactor[r] = get(r, pivotCol) / rowFactor[pivotCol];
+    for (int c = 0; c < dim; c++) {
+      if ( get(r, c) != colFactor[r] * rowFactor[c] ) {
+	return;
+      }
+    }
+  }
+  separable = true;
+}
+
+bool Filter::isSeparable()
+{
+  return separable;
+}
+
+int Filter::getRowFactor(int c)
+{
+  return rowFactor[c];
+}
+
+int Filter::getColFactor(int r)
+{
+  return colFactor[r];
+}
+
+bool Filter::isBox()
+{
+  return box;
+}
+
+long long Filter::getMinSum()
+{
+  return minSum;
+}
+
+long long Filter::getMaxSum()
+{
+  return maxSum;
+}
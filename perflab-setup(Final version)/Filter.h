@@ -9,6 +9,25 @@ class Filter {
   int dim;
   int *data;
 
+  //
+  // Set by analyze(). A separable filter is the outer product of a
+  // column and a row: get(r, c) == colFactor[r] * rowFactor[c].
+  //
+  bool separable;
+  int *rowFactor;
+  int *colFactor;
+
+  //
+  // Every coefficient is the same
+  //
+  bool box;
+
+  //
+  // The most negative and most positive sums pixels of 0..255 can give
+  //
+  long long minSum;
+  long long maxSum;
+
 public:
   Filter(int _dim);
   int get(int r, int c);
@@ -19,6 +38,26 @@ public:
 
   int getSize();
   void info();
+
+  //
+  // Works out the properties below from the current coefficients; call
+  // again after changing them
+  //
+  void analyze();
+
+  bool isSeparable();
+  int getRowFactor(int c);
+  int getColFactor(int r);
+
+  bool isBox();
+
+  //
+  // The range of the sum, before the divisor, over all 8-bit inputs.
+  // Any sum of some of the products is inside it too, so it tells how
+  // narrow an accumulator can be.
+  //
+  long long getMinSum();
+  long long getMaxSum();
 };
 
 #endif
@@ -0,0 +1,544 @@
+#include <stdio.h>
+#include "FilterApply.h"
+#include "FilterTrace.h"
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+#include "rdtsc.h"
+
+KernelPath kernelPath = KERNEL_SCALAR;
+thread_local ThreadPool *pool = NULL;
+bool useSeparable = true;
+bool useBox = true;
+int tileOption = -1;
+bool reportFilters = true;
+
+struct Filter *
+readFilter(string filename)
+{
+  ifstream input(filename.c_str());
+
+  if ( ! input.bad() ) {
+    int size = 0;
+    input >> size;
+    //
+    // The filter is centered on the pixel, so it needs an odd size
+    //
+    if ( size < 1 || size % 2 == 0 || size > KERNEL_MAX_SIZE ) {
+      cerr << "Filter size must be odd and at most " << KERNEL_MAX_SIZE
+	   << " in readFilter:" << filename << endl;
+      exit(-1);
+    }
+    Filter *filter = new Filter(size);
+    int div;
+    input >> div;
+    filter -> setDivisor(div);
+    for (int i=0; i < size; i++) {
+      for (int j=0; j < size; j++) {
+	int value;
+	input >> value;
+	filter -> set(i,j,value);
+      }
+    }
+    filter -> analyze();
+    return filter;
+  } else {
+    cerr << "Bad input in readFilter:" << filename << endl;
+    exit(-1);
+  }
+}
+
+/*
+the border, RADIUS rows deep, is never filtered, so it is set to 0 here
+instead of relying on the output storage starting out zeroed
+*/
+static void
+clearBorderRows(cs1300image *output, int plane, int radius)
+{
+  for (int row = 0; row < output -> height; row++) {
+    if ( row < radius || row >= output -> height - radius ) {
+      memset(cs1300image_row(output, plane, row), 0, output -> width * sizeof(cs1300pixel));
+    }
+  }
+}
+
+double
+reportCycles(long long cycStart, long long cycStop, double pixels)
+{
+  double diff = cycStop - cycStart;
+  double diffPerPixel = diff / pixels;
+  if ( reportFilters ) {
+    fprintf(stderr, "Took %f cycles to process, or %f cycles per pixel\n",
+	    diff, diff / pixels);
+  }
+  return diffPerPixel;
+}
+
+static double
+reportCycles(long long cycStart, long long cycStop, cs1300image *output)
+{
+  return reportCycles(cycStart, cycStop, (double) output -> width * output -> height);
+}
+
+//
+// One call of applyFilter. The interior rows are split into one band of
+// rows per thread, and each band does all three planes of its rows.
+//
+struct FilterJob {
+  cs1300image *input;
+  cs1300view *view;
+  cs1300image *output;
+  FilterStage stage;
+  //
+  // Set when the filter factors into a row and a column
+  //
+  bool useSeparable;
+  KernelSeparable separable;
+  //
+  // Set when every coefficient is the same
+  //
+  bool useBox;
+  //
+  // When bankCount is nonzero the job runs a bank of 3x3 filters in one
+  // sweep instead of stage, bankKernels[k] into bankOutputs[k]
+  //
+  int bankCount;
+  cs1300image *bankOutputs[KERNEL_BANK_MAX];
+  Kernel3x3 bankKernels[KERNEL_BANK_MAX];
+  BankFilter3x3 bankRow;
+  //
+  // Rows each band does at a time, all three planes
+  //
+  int tileRows;
+  int bands;
+  //
+  // First row of each band, and the thread and cycles it took
+  //
+  vector<int> bandStart;
+  vector<int> bandThread;
+  vector<long long> bandCycles;
+};
+
+/*
+filters rows FIRST .. LAST-1 of all three planes, with whichever engine
+the job uses; SCRATCH is the engine's, for rows of this width
+*/
+static void
+filterTile(FilterJob *job, int first, int last, void *scratch)
+{
+  TRACE_SPAN("tile", first);
+  int width = job -> output -> width;
+  int radius = job -> stage.radius;
+
+  if ( job -> bankCount > 0 ) {
+    //
+    // Every filter of the bank from the same three input rows
+    //
+    cs1300pixel *outs[KERNEL_BANK_MAX];
+    for(int plane = 0; plane < 3; plane++){
+      for(int row = first; row < last ; row++){
+	for (int k = 0; k < job -> bankCount; k++) {
+	  outs[k] = cs1300image_row(job -> bankOutputs[k], plane, row);
+	}
+	job -> bankRow(cs1300image_row(job -> input, plane, row - 1),
+		       cs1300image_row(job -> input, plane, row),
+		       cs1300image_row(job -> input, plane, row + 1),
+		       outs, width, job -> bankKernels, job -> bankCount);
+      }
+    }
+  } else if ( job -> useBox ) {
+    //
+    // Running sums over the rows and columns of the box
+    //
+    for(int plane = 0; plane < 3; plane++){
+      if ( job -> view ) {
+	filterBandBoxInterleaved(job -> view -> pixels + CS1300VIEW_OFFSET(plane), job -> view -> stride,
+				 job -> output, plane, first, last, &job -> stage.kernelN, scratch);
+      } else {
+	filterBandBox(kernelPath, job -> input -> color[plane], job -> input -> stride,
+		      job -> output, plane, first, last, &job -> stage.kernelN, scratch);
+      }
+    }
+  } else if ( job -> useSeparable ) {
+    //
+    // Two passes, with a filter's height of horizontal sums kept per
+    // thread
+    //
+    for(int plane = 0; plane < 3; plane++){
+      filterBandSeparable(job -> input, job -> output, plane, first, last,
+			  &job -> separable, scratch);
+    }
+  } else {
+/*
+    reordered loops so that they would have better spatial locality
+    In the nested For loop, if the loop with more iteration is put inside, and the loop with less iteration is put outside,
+    its performance will be improved; Reducing the instantiation of loop variables also improves their performance.
+
+    the nested loop read the elements of the array in row-major-order
+
+*/
+    /*
+    pointers to the input rows around the output row, so the inner loop
+    only has to index by column; rows[i] is input row (row - radius + i)
+    */
+    const cs1300pixel *rows[KERNEL_MAX_SIZE];
+    const unsigned char *viewRows[KERNEL_MAX_SIZE];
+    for(int plane = 0; plane < 3; plane++){
+      for(int row = first; row < last ; row++){
+	cs1300pixel *out = cs1300image_row(job -> output, plane, row);
+	if ( job -> view ) {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    viewRows[i] = cs1300view_row(job -> view, row - radius + i) + CS1300VIEW_OFFSET(plane);
+	  }
+	  filterRowNxNInterleaved(viewRows, out, width, &job -> stage.kernelN);
+	} else {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    rows[i] = cs1300image_row(job -> input, plane, row - radius + i);
+	  }
+	  filterStageRow(&job -> stage, rows, out, width);
+	}
+      }
+    }
+  }
+}
+
+static void
+filterBand(int band, void *arg)
+{
+  FilterJob *job = (FilterJob *) arg;
+  TRACE_SPAN("band", band);
+  long long cycStart = rdtscll();
+  int first = job -> bandStart[band];
+  int last = job -> bandStart[band + 1];
+  int width = job -> output -> width;
+  vector<char> scratch(job -> useBox ? boxScratchSize(width)
+		       : job -> useSeparable ? separableScratchSize(job -> separable.size, width) : 0);
+
+  //
+  // A tile of rows at a time, all three planes of it before the next
+  // tile, so the input rows of the tile are still in cache when the
+  // next plane reads them; interleaved input is read once instead of
+  // three times
+  //
+  for (int tile = first; tile < last; tile += job -> tileRows) {
+    filterTile(job, tile, min(tile + job -> tileRows, last), scratch.data());
+  }
+
+  job -> bandThread[band] = ThreadPool::worker();
+  job -> bandCycles[band] = rdtscll() - cycStart;
+}
+
+/*
+rows per tile for JOB: as many as keep the tile's input rows, halo
+included, and its output rows in half the L2 cache
+*/
+static int
+tileRows(FilterJob *job)
+{
+  int height = job -> output -> height;
+  if ( tileOption == 0 ) {
+    return max(height, 1);
+  }
+  if ( tileOption > 0 ) {
+    return tileOption;
+  }
+  int radius = job -> stage.radius;
+  size_t outputBytes = (size_t) 3 * job -> output -> width * sizeof(cs1300pixel) * max(job -> bankCount, 1);
+  size_t inputBytes = job -> view ? labs(job -> view -> stride)
+    : (size_t) 3 * job -> output -> width * sizeof(cs1300pixel);
+  size_t budget = ThreadPool::cacheSize(2) / 2;
+  long rows = ((long) budget - 2 * radius * (long) inputBytes) / (long) (inputBytes + outputBytes);
+  //
+  // Each tile restarts the box and separable engines, which costs about
+  // a halo of rows, so tiles are kept well above that
+  //
+  return max(rows, (long) max(16, 16 * radius));
+}
+
+static double
+runFilterJob(FilterJob *job)
+{
+  long long cycStart, cycStop;
+  cycStart = rdtscll();
+
+  cs1300image *output = job -> output;
+  int radius = job -> stage.radius;
+  job -> tileRows = tileRows(job);
+
+  for(int plane = 0; plane < 3; plane++){
+    clearBorderRows(output, plane, radius);
+    for (int k = 1; k < job -> bankCount; k++) {
+      clearBorderRows(job -> bankOutputs[k], plane, radius);
+    }
+  }
+
+  //
+  // Rows radius .. height-radius-1, split as evenly as possible
+  //
+  int rows = max(output -> height - 2 * radius, 0);
+  job -> bands = min(pool -> size(), max(rows, 1));
+  job -> bandStart.resize(job -> bands + 1);
+  job -> bandThread.assign(job -> bands, 0);
+  job -> bandCycles.assign(job -> bands, 0);
+  for (int band = 0; band <= job -> bands; band++) {
+    job -> bandStart[band] = radius + (long long) rows * band / job -> bands;
+  }
+
+  pool -> run(job -> bands, filterBand, job);
+
+  cycStop = rdtscll();
+  double perPixel = reportCycles(cycStart, cycStop, output);
+  if ( ! reportFilters ) {
+    return perPixel;
+  }
+  //
+  // Every input sample read once and every output sample written once
+  //
+  double bytes = (double) output -> height
+    * ((job -> view ? labs(job -> view -> stride) : 3.0 * output -> width * sizeof(cs1300pixel))
+       + 3.0 * output -> width * sizeof(cs1300pixel) * max(job -> bankCount, 1));
+  fprintf(stderr, "Moved %f bytes per cycle, %d rows per tile\n",
+	  bytes / max(cycStop - cycStart, 1LL), job -> tileRows);
+
+  if ( job -> bands > 1 ) {
+    for (int band = 0; band < job -> bands; band++) {
+      int bandPixels = (job -> bandStart[band + 1] - job -> bandStart[band]) * output -> width;
+      fprintf(stderr, "  thread %d took %f cycles for rows %d-%d, %f cycles per pixel\n",
+	      job -> bandThread[band], (double) job -> bandCycles[band],
+	      job -> bandStart[band], job -> bandStart[band + 1] - 1,
+	      bandPixels ? (double) job -> bandCycles[band] / bandPixels : 0.0);
+    }
+  }
+  return perPixel;
+}
+
+/*
+runs every stage of a --graph chain, and reports the cycles the way
+applyFilter does
+*/
+double
+applyFilterGraph(FilterGraph *graph, cs1300image *input, cs1300image *output)
+{
+  long long cycStart = rdtscll();
+  graph -> apply(pool, input, output);
+  return reportCycles(cycStart, rdtscll(), output);
+}
+
+double
+applyFilterGraph(FilterGraph *graph, cs1300view *input, cs1300image *output)
+{
+  long long cycStart = rdtscll();
+  graph -> apply(pool, input, output);
+  return reportCycles(cycStart, rdtscll(), output);
+}
+
+/*
+sets up JOB to run FILTER on INPUT into OUTPUT, choosing the engine the
+way applyFilter does
+*/
+static void
+loadFilterJob(struct Filter *filter, cs1300image *input, cs1300image *output, FilterJob *job)
+{
+  cs1300image_resize(output, input -> width, input -> height);
+
+  job -> input = input;
+  job -> view = NULL;
+  job -> output = output;
+  job -> bankCount = 0;
+  filterStageLoad(kernelPath, filter, &job -> stage);
+  //
+  // At 3x3 running sums lose to the vector 2D kernels, and to two
+  // passes, which every box filter can take
+  //
+  job -> useBox = useBox && job -> stage.radius != 1 && ! job -> stage.kernelN.identity
+    && kernelIsBox(filter, &job -> stage.kernelN);
+  //
+  // Two passes take 2N multiplies a pixel instead of N*N, and beat the
+  // 2D kernels at every size on every path but one: at 3x3 the SSE4.1
+  // kernel does all nine taps in fewer cycles
+  //
+  bool sse41Wins = job -> stage.filterRow != NULL && kernelPath == KERNEL_SSE41;
+  job -> useSeparable = useSeparable && ! job -> useBox && ! sse41Wins
+    && kernelLoadSeparable(kernelPath, filter, &job -> stage.kernelN, &job -> separable);
+}
+
+double
+applyFilter(struct Filter *filter, cs1300image *input, cs1300image *output)
+{
+  FilterJob job;
+
+  loadFilterJob(filter, input, output, &job);
+  return runFilterJob(&job);
+}
+
+/*
+same as above, but reads the interleaved pixels of a mapped file in
+place, so there is no copy into planes before filtering
+*/
+double
+applyFilter(struct Filter *filter, cs1300view *input, cs1300image *output)
+{
+  FilterJob job;
+
+  cs1300image_resize(output, input -> width, input -> height);
+
+  job.input = NULL;
+  job.view = input;
+  job.output = output;
+  job.bankCount = 0;
+  filterStageLoad(kernelPath, filter, &job.stage);
+  job.useBox = useBox && ! job.stage.kernelN.identity && kernelIsBox(filter, &job.stage.kernelN);
+  job.useSeparable = false;
+
+  return runFilterJob(&job);
+}
+
+//
+// One call of applyFilter on the interleaved layout
+//
+struct PackedJob {
+  cs1300view *input;
+  cs1300packed *output;
+  FilterStage stage;
+  //
+  // The interleaved 3x3 kernel, or NULL to run the N x N kernel on each
+  // color
+  //
+  RowFilter3x3 filterRow;
+  vector<int> bandStart;
+};
+
+static void
+filterPackedBand(int band, void *arg)
+{
+  PackedJob *job = (PackedJob *) arg;
+  TRACE_SPAN("band", band);
+  int width = job -> output -> width;
+  int radius = job -> stage.radius;
+  const unsigned char *viewRows[KERNEL_MAX_SIZE];
+  vector<cs1300pixel> line(width);
+
+  for (int row = job -> bandStart[band]; row < job -> bandStart[band + 1]; row++) {
+    unsigned char *out = cs1300packed_row(job -> output, row);
+    if ( job -> filterRow ) {
+      //
+      // All three colors at once, straight from the input rows
+      //
+      job -> filterRow((const cs1300pixel *) cs1300view_row(job -> input, row - 1),
+		       (const cs1300pixel *) cs1300view_row(job -> input, row),
+		       (const cs1300pixel *) cs1300view_row(job -> input, row + 1),
+		       (cs1300pixel *) out, width, &job -> stage.kernel);
+      continue;
+    }
+    for(int plane = 0; plane < 3; plane++){
+      for (int i = 0; i <= 2 * radius; i++) {
+	viewRows[i] = cs1300view_row(job -> input, row - radius + i) + CS1300VIEW_OFFSET(plane);
+      }
+      filterRowNxNInterleaved(viewRows, line.data(), width, &job -> stage.kernelN);
+      for (int col = 0; col < width; col++) {
+	out[3 * col + CS1300VIEW_OFFSET(plane)] = line[col];
+      }
+    }
+  }
+}
+
+/*
+same again with the output interleaved too, so an image goes from file
+to file without ever being split into planes. Each input row is read
+once for all three colors.
+*/
+double
+applyFilter(struct Filter *filter, cs1300view *input, cs1300packed *output)
+{
+  long long cycStart = rdtscll();
+  PackedJob job;
+
+  cs1300packed_resize(output, input -> width, input -> height);
+  job.input = input;
+  job.output = output;
+  filterStageLoad(kernelPath, filter, &job.stage);
+  job.filterRow = NULL;
+  if ( job.stage.radius == 1 && ! job.stage.kernelN.identity ) {
+    job.filterRow = rowFilter3x3Interleaved(kernelPath, &job.stage.kernel);
+  }
+
+  int radius = job.stage.radius;
+  for (int row = 0; row < output -> height; row++) {
+    if ( row < radius || row >= output -> height - radius ) {
+      memset(cs1300packed_row(output, row), 0, 3 * output -> width);
+    }
+  }
+  int rows = max(output -> height - 2 * radius, 0);
+  int bands = min(pool -> size(), max(rows, 1));
+  job.bandStart.resize(bands + 1);
+  for (int band = 0; band <= bands; band++) {
+    job.bandStart[band] = radius + (long long) rows * band / bands;
+  }
+  pool -> run(bands, filterPackedBand, &job);
+
+  return reportCycles(cycStart, rdtscll(), (double) output -> width * output -> height);
+}
+
+/*
+runs COUNT filters over one INPUT, filters[k] into outputs[k]. The 3x3
+filters the vector kernels can run go through in banks of up to
+KERNEL_BANK_MAX, a sweep over the image each; the rest take the engine
+applyFilter would give them. Returns the cycles per pixel of all of them.
+*/
+double
+applyFilterBank(struct Filter **filters, int count, cs1300image *input, cs1300image **outputs)
+{
+  double perPixel = 0;
+  FilterJob bank;
+
+  bank.bankCount = 0;
+  for (int k = 0; k < count; k++) {
+    FilterJob job;
+    loadFilterJob(filters[k], input, outputs[k], &job);
+    if ( job.stage.filterRow == NULL ) {
+      perPixel += runFilterJob(&job);
+      continue;
+    }
+    if ( bank.bankCount == 0 ) {
+      bank.input = input;
+      bank.view = NULL;
+      bank.output = outputs[k];
+      bank.stage = job.stage;
+      bank.useSeparable = false;
+      bank.useBox = false;
+    }
+    bank.bankOutputs[bank.bankCount] = outputs[k];
+    bank.bankKernels[bank.bankCount] = job.stage.kernel;
+    bank.bankCount++;
+    if ( bank.bankCount == KERNEL_BANK_MAX ) {
+      bank.bankRow = bankFilter3x3(kernelPath, bank.bankKernels, bank.bankCount);
+      perPixel += runFilterJob(&bank);
+      bank.bankCount = 0;
+    }
+  }
+  if ( bank.bankCount > 0 ) {
+    bank.bankRow = bankFilter3x3(kernelPath, bank.bankKernels, bank.bankCount);
+    perPixel += runFilterJob(&bank);
+  }
+  return perPixel;
+}
+
+/*
+a mapped file has no planes for the bank kernels to read, so each
+filter takes its own sweep over the one mapping
+*/
+double
+applyFilterBank(struct Filter **filters, int count, cs1300view *input, cs1300image **outputs)
+{
+  double perPixel = 0;
+  for (int k = 0; k < count; k++) {
+    perPixel += applyFilter(filters[k], input, outputs[k]);
+  }
+  return perPixel;
+}
@@ -0,0 +1,95 @@
+//-*-c++-*-
+#ifndef _FilterApply_h_
+#define _FilterApply_h_
+
+#include "cs1300bmp.h"
+#include "Filter.h"
+#include "FilterKernels.h"
+#include "FilterGraph.h"
+#include "ThreadPool.h"
+#include <string>
+
+using namespace std;
+
+//
+// Running filters over whole images, with the engine each one suits,
+// split across the threads of a pool. The filter program and the
+// benchmark both use it; the settings below are theirs to change before
+// filtering.
+//
+
+//
+// Which convolution code applyFilter runs; set once at startup
+//
+extern KernelPath kernelPath;
+
+//
+// Threads applyFilter splits each image across; must be set before
+// filtering. A thread that filters whole images of its own can have a
+// pool of its own.
+//
+extern thread_local ThreadPool *pool;
+
+//
+// Whether separable filters run as two 1D passes
+//
+extern bool useSeparable;
+
+//
+// Whether box filters run on running sums
+//
+extern bool useBox;
+
+//
+// Rows per tile of applyFilter; 0 for a tile per band, -1 to size them
+// to the L2 cache
+//
+extern int tileOption;
+
+//
+// Whether applyFilter prints its cycles, and those of each thread, on
+// stderr; on unless the caller keeps its own time
+//
+extern bool reportFilters;
+
+//
+// Reads a filter file, exiting if it is not usable
+//
+Filter *readFilter(string filename);
+
+//
+// Each returns the cycles per pixel it took, and prints them if
+// reportFilters is set
+//
+double applyFilter(Filter *filter, cs1300image *input, cs1300image *output);
+double applyFilter(Filter *filter, cs1300view *input, cs1300image *output);
+double applyFilter(Filter *filter, cs1300view *input, cs1300packed *output);
+double applyFilterGraph(FilterGraph *graph, cs1300image *input, cs1300image *output);
+double applyFilterGraph(FilterGraph *graph, cs1300view *input, cs1300image *output);
+double applyFilterBank(Filter **filters, int count, cs1300image *input, cs1300image **outputs);
+double applyFilterBank(Filter **filters, int count, cs1300view *input, cs1300image **outputs);
+
+//
+// Cycles per pixel for PIXELS done between the two counts, printed the
+// way applyFilter prints them
+//
+double reportCycles(long long cycStart, long long cycStop, double pixels);
+
+//
+// Runs the --graph chain if there is one, else the COUNT filters, on
+// one input
+//
+template <class Input>
+double
+applyFilters(FilterGraph *graph, Filter **filters, int count, Input *input, cs1300image **outputs)
+{
+  if ( graph ) {
+    return applyFilterGraph(graph, input, outputs[0]);
+  } else if ( count > 1 ) {
+    return applyFilterBank(filters, count, input, outputs);
+  } else {
+    return applyFilter(filters[0], input, outputs[0]);
+  }
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include "FilterGraph.h"
+#include "FilterTrace.h"
+#include <string.h>
+#include <algorithm>
+
+//
+// Fewest output rows in a tile, so the recomputed halo stays a small
+// part of the work
+//
+static const int graphMinTileRows = 16;
+
+FilterGraph::FilterGraph(KernelPath path, Filter **filters, int count)
+  : stages(count), halo(count)
+{
+  for (int s = 0; s < count; s++) {
+    filterStageLoad(path, filters[s], &stages[s]);
+  }
+  int after = 0;
+  for (int s = count - 1; s >= 0; s--) {
+    halo[s] = after;
+    after += stages[s].radius;
+  }
+}
+
+int
+FilterGraph::size()
+{
+  return stages.size();
+}
+
+int
+FilterGraph::tileRows(int width, int height)
+{
+  //
+  // Every stage but the last keeps its rows of the tile plus its halo
+  // on each side, one plane at a time
+  //
+  size_t haloRows = 0;
+  int intermediates = size() - 1;
+  for (int s = 0; s < intermediates; s++) {
+    haloRows += 2 * halo[s];
+  }
+  int rows = height;
+  if ( intermediates > 0 && width > 0 ) {
+    //
+    // Half the L2 leaves room for the input and output rows streaming
+    // past
+    //
+    size_t fit = ThreadPool::cacheSize(2) / 2 / (width * sizeof(cs1300pixel));
+    rows = fit > haloRows ? (fit - haloRows) / intermediates : 0;
+  }
+  return max(min(rows, height), min(graphMinTileRows, max(height, 1)));
+}
+
+//
+// One call of FilterGraph::apply
+//
+struct GraphJob {
+  FilterGraph *graph;
+  cs1300image *input;
+  cs1300view *view;
+  cs1300image *output;
+  int tileRows;
+  //
+  // Per thread, the rows each stage but the last writes for the tile
+  //
+  vector< vector<cs1300pixel> > buffers;
+};
+
+void
+FilterGraph::runTile(int tile, void *arg)
+{
+  GraphJob *job = (GraphJob *) arg;
+  FilterGraph *graph = job -> graph;
+  TRACE_SPAN("tile", tile * job -> tileRows);
+  int width = job -> output -> width;
+  int height = job -> output -> height;
+  int count = graph -> size();
+  int first = tile * job -> tileRows;
+  int last = min(first + job -> tileRows, height);
+  cs1300pixel *buffer = job -> buffers[ThreadPool::worker()].data();
+
+  //
+  // Stage s writes rows lo[s] .. hi[s]-1; unless it is the last stage,
+  // row r goes to rowsOf[s] + (r - lo[s]) * width
+  //
+  vector<int> lo(count), hi(count);
+  vector<cs1300pixel *> rowsOf(count, (cs1300pixel *) NULL);
+  size_t used = 0;
+  for (int s = 0; s < count; s++) {
+    lo[s] = max(first - graph -> halo[s], 0);
+    hi[s] = min(last + graph -> halo[s], height);
+    if ( s < count - 1 ) {
+      rowsOf[s] = buffer + used;
+      used += (size_t) (hi[s] - lo[s]) * width;
+    }
+  }
+
+  const cs1300pixel *rows[KERNEL_MAX_SIZE];
+  const unsigned char *viewRows[KERNEL_MAX_SIZE];
+
+  for (int plane = 0; plane < 3; plane++) {
+    for (int s = 0; s < count; s++) {
+      FilterStage *stage = &graph -> stages[s];
+      int radius = stage -> radius;
+
+      for (int row = lo[s]; row < hi[s]; row++) {
+	cs1300pixel *out = s == count - 1 ? cs1300image_row(job -> output, plane, row)
+	  : rowsOf[s] + (size_t) (row - lo[s]) * width;
+
+	if ( row < radius || row >= height - radius ) {
+	  memset(out, 0, width * sizeof(cs1300pixel));
+	} else if ( s > 0 ) {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    rows[i] = rowsOf[s - 1] + (size_t) (row - radius + i - lo[s - 1]) * width;
+	  }
+	  filterStageRow(stage, rows, out, width);
+	} else if ( job -> view ) {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    viewRows[i] = cs1300view_row(job -> view, row - radius + i) + CS1300VIEW_OFFSET(plane);
+	  }
+	  filterRowNxNInterleaved(viewRows, out, width, &stage -> kernelN);
+	} else {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    rows[i] = cs1300image_row(job -> input, plane, row - radius + i);
+	  }
+	  filterStageRow(stage, rows, out, width);
+	}
+      }
+    }
+  }
+}
+
+void
+FilterGraph::run(ThreadPool *pool, GraphJob *job)
+{
+  int width = job -> output -> width;
+  int height = job -> output -> height;
+
+  job -> tileRows = tileRows(width, height);
+  int tiles = (height + job -> tileRows - 1) / job -> tileRows;
+
+  size_t rows = 0;
+  for (int s = 0; s < size() - 1; s++) {
+    rows += job -> tileRows + 2 * halo[s];
+  }
+  job -> buffers.resize(pool -> size());
+  for (int thread = 0; thread < pool -> size(); thread++) {
+    job -> buffers[thread].resize(rows * width);
+  }
+
+  pool -> run(tiles, runTile, job);
+}
+
+void
+FilterGraph::apply(ThreadPool *pool, cs1300image *input, cs1300image *output)
+{
+  GraphJob job;
+
+  cs1300image_resize(output, input -> width, input -> height);
+  job.graph = this;
+  job.input = input;
+  job.view = NULL;
+  job.output = output;
+  run(pool, &job);
+}
+
+void
+FilterGraph::apply(ThreadPool *pool, cs1300view *input, cs1300image *output)
+{
+  GraphJob job;
+
+  cs1300image_resize(output, input -> width, input -> height);
+  job.graph = this;
+  job.input = NULL;
+  job.view = input;
+  job.output = output;
+  run(pool, &job);
+}
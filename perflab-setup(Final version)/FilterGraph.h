@@ -0,0 +1,59 @@
+//-*-c++-*-
+#ifndef _FilterGraph_h_
+#define _FilterGraph_h_
+
+#include "cs1300bmp.h"
+#include "Filter.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
+#include <vector>
+
+using namespace std;
+
+//
+// A chain of filters run as one: each stage filters the output of the
+// stage before, with the same result as writing every stage out and
+// reading it back in for the next. The image is done a tile of rows at
+// a time, and each plane of a tile goes through all the stages before
+// the next plane starts, so the rows passed between stages stay in
+// cache and no full-size intermediate image is made. Each tile
+// recomputes the halo of rows that its later stages need from the
+// stages before.
+//
+class FilterGraph {
+  vector<FilterStage> stages;
+  //
+  // Rows below and above a tile that stage s must produce for the
+  // stages after it
+  //
+  vector<int> halo;
+
+  //
+  // Filters tile TILE of the GraphJob at ARG, on one thread of the pool
+  //
+  static void runTile(int tile, void *arg);
+
+  //
+  // Sizes each thread's rows for JOB and runs all of its tiles
+  //
+  void run(ThreadPool *pool, struct GraphJob *job);
+
+public:
+  FilterGraph(KernelPath path, Filter **filters, int count);
+
+  int size();
+
+  //
+  // Output rows per tile for a WIDTH x HEIGHT image, chosen so the
+  // intermediate rows of a tile stay in the L2 cache
+  //
+  int tileRows(int width, int height);
+
+  //
+  // Runs every stage over INPUT, into OUTPUT, using the threads of POOL
+  //
+  void apply(ThreadPool *pool, cs1300image *input, cs1300image *output);
+  void apply(ThreadPool *pool, cs1300view *input, cs1300image *output);
+};
+
+#endif
@@ -0,0 +1,1865 @@
+#include "FilterKernels.h"
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include <algorithm>
+
+//
+// Every path computes, for each interior pixel, the sum of the nine
+// products in an int. With a divisor above 1 the sum is divided
+// (truncating) and the low byte kept; otherwise it is clamped to
+// 0..255. The vector paths divide in single precision, which gives the
+// exact truncated quotient as long as |sum| < 2^24.
+//
+
+static const char *pathNames[KERNEL_PATHS] = { "scalar", "sse4", "avx2", "avx512" };
+
+const char *
+kernelPathName(KernelPath path)
+{
+  return pathNames[path];
+}
+
+KernelPath
+kernelPathNamed(const char *name)
+{
+  for (int path = 0; path < KERNEL_PATHS; path++) {
+    if ( strcmp(name, pathNames[path]) == 0 ) {
+      return (KernelPath) path;
+    }
+  }
+  return KERNEL_PATHS;
+}
+
+KernelPath
+kernelPathDetect()
+{
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx512bw") ) {
+    return KERNEL_AVX512;
+  }
+  if ( __builtin_cpu_supports("avx2") ) {
+    return KERNEL_AVX2;
+  }
+  if ( __builtin_cpu_supports("sse4.1") ) {
+    return KERNEL_SSE41;
+  }
+  return KERNEL_SCALAR;
+}
+
+//
+// Finds MULTIPLIER and SHIFT, with SHIFT at least MINSHIFT and
+// MULTIPLIER at most LIMIT, such that n * multiplier >> shift equals
+// n / divisor for every 0 <= n <= reach. Taking multiplier =
+// ceil(2^shift / divisor) and e = multiplier * divisor - 2^shift, that
+// holds whenever reach * e < 2^shift.
+//
+static bool
+findReciprocal(int divisor, long long reach, int minShift, unsigned long long limit,
+	       unsigned long long *multiplier, int *shift)
+{
+  for (int s = minShift; s < 63; s++) {
+    unsigned long long power = 1ULL << s;
+    unsigned long long m = (power + divisor - 1) / divisor;
+    if ( m > limit ) {
+      return false;
+    }
+    if ( (unsigned long long) reach * (m * divisor - power) < power ) {
+      *multiplier = m;
+      *shift = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool allowNarrow = true;
+
+void
+kernelAllowNarrow(bool allow)
+{
+  allowNarrow = allow;
+}
+
+void
+kernelLoad3x3(Filter *filter, Kernel3x3 *kernel)
+{
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      kernel -> coef[i * 3 + j] = filter -> get(i, j);
+    }
+  }
+  kernel -> divisor = filter -> getDivisor();
+
+  long long reach = 0;
+  for (int i = 0; i < 9; i++) {
+    reach += 255LL * abs(kernel -> coef[i]);
+  }
+  unsigned long long multiplier;
+  kernel -> multiplier = 0;
+  kernel -> shift = 0;
+  if ( kernel -> divisor > 1 && reach <= 32767
+       && findReciprocal(kernel -> divisor, reach, 16, 0xffff, &multiplier, &kernel -> shift) ) {
+    kernel -> multiplier = (int) multiplier;
+    kernel -> shift -= 16;
+  }
+
+  //
+  // The sums may not reach -32768 either, which has no 16-bit absolute
+  // value to divide
+  //
+  kernel -> narrow = allowNarrow && sizeof(cs1300pixel) == 1
+    && filter -> getMinSum() >= -32767 && filter -> getMaxSum() <= 32767
+    && ( kernel -> divisor <= 1 || kernel -> multiplier != 0 );
+  for (int i = 0; i < 9; i++) {
+    if ( kernel -> coef[i] < -128 || kernel -> coef[i] > 127 ) {
+      kernel -> narrow = false;
+    }
+  }
+}
+
+/*
+the reference loop. STEP is the distance between neighboring pixels of
+the plane, in the input rows and in out: 1 for a cs1300image plane, 3
+for interleaved BGR rows. Computes pixels colStart .. colEnd-1
+*/
+template <int STEP, class Pixel>
+static void
+filterSpan(const Pixel *above, const Pixel *middle, const Pixel *below,
+	   cs1300pixel *out, int colStart, int colEnd, const Kernel3x3 *kernel)
+{
+  int output0, output1, output2;
+  int filterdivisor = kernel -> divisor;
+
+  for( int col = colStart; col < colEnd; col++){
+
+
+        const int* FILTER_V = &kernel -> coef[0];
+
+        /*urolled two loops so that there would be less overhead over iterations*/
+        output0 = (above[(col-1) * STEP] * *(FILTER_V++));
+        output1 = (above[col * STEP] * *(FILTER_V++));
+        output2 = (above[(col+1) * STEP] * *(FILTER_V++));
+
+        output0 += (middle[(col-1) * STEP] * *(FILTER_V++));
+        output1 += (middle[col * STEP] * *(FILTER_V++));
+        output2 += (middle[(col+1) * STEP] * *(FILTER_V++));
+
+        output0 += (below[(col-1) * STEP] * *(FILTER_V++));
+        output1 += (below[col * STEP] * *(FILTER_V++));
+        output2 += (below[(col+1) * STEP] * *(FILTER_V++));
+
+        cs1300accum value = output0 + output1 + output2;
+
+		/*used three accumulators to hold data and then combined them at the end
+		so computations can be done in parallel and there would be less dependency*/
+
+
+		/*made a condition for divisor so division will not be done or done less frequently if the divisor is 1*/
+        if ( filterdivisor > 1){
+            value /= filterdivisor;
+        }
+
+        else if ( value < 0 ){
+            value = 0;
+            }
+
+        else if ( value > 255 ){
+            value = 255;
+            }
+
+        /*the value is accumulated as an int and only narrowed to the pixel type here*/
+        out[col * STEP] = (cs1300pixel) value;
+  }
+}
+
+static void
+filterRowScalar(const cs1300pixel *above, const cs1300pixel *middle,
+		const cs1300pixel *below, cs1300pixel *out,
+		int width, const Kernel3x3 *kernel)
+{
+  out[0] = 0;
+  out[width-1] = 0;
+  filterSpan<1>(above, middle, below, out, 1, width-1, kernel);
+}
+
+/*
+an interleaved row is three planes woven together, so the same filter
+over the samples with neighbors 3 apart filters every color at once.
+Finishes pixels WIDTH-2 back to wherever the vector loop stopped, SAMPLE
+counting in samples; DX 1 is a plain plane.
+*/
+template <int DX>
+static inline __attribute__((always_inline)) void
+filterTail(const cs1300pixel *above, const cs1300pixel *middle,
+	   const cs1300pixel *below, cs1300pixel *out,
+	   int sample, int width, const Kernel3x3 *kernel)
+{
+  for (int color = 0; color < DX; color++) {
+    int col = (sample - color + DX - 1) / DX;
+    filterSpan<DX>(above + color, middle + color, below + color, out + color,
+		   max(col, 1), width-1, kernel);
+  }
+}
+
+static void
+filterRowInterleavedScalar(const cs1300pixel *above, const cs1300pixel *middle,
+			   const cs1300pixel *below, cs1300pixel *out,
+			   int width, const Kernel3x3 *kernel)
+{
+  memset(out, 0, 3);
+  memset(out + 3 * (width-1), 0, 3);
+  filterTail<3>(above, middle, below, out, 3, width, kernel);
+}
+
+//
+// The vector paths widen pixels to 16 bits and multiply-add pairs of
+// taps (pmaddwd), so tap 2p and 2p+1 share one 32-bit coefficient
+// word; the ninth tap is paired with a zero pixel. Each pass computes
+// one vector of samples starting at sample COL, whose neighbors are DX
+// samples away: 1 in a plane, 3 in an interleaved row, where a vector
+// holds all three colors of a third as many pixels.
+//
+
+static int
+pairedCoef(const Kernel3x3 *kernel, int pair)
+{
+  int first = kernel -> coef[2 * pair];
+  int second = (2 * pair + 1 < 9) ? kernel -> coef[2 * pair + 1] : 0;
+  return (int) ((first & 0xffff) | ((unsigned) second << 16));
+}
+
+//
+// The narrow paths multiply bytes instead (pmaddubsw): pixels stay
+// unsigned bytes, paired with the next tap's byte, and each pair of
+// signed byte coefficients makes one 16-bit word
+//
+static short
+pairedBytes(const Kernel3x3 *kernel, int pair)
+{
+  int first = kernel -> coef[2 * pair];
+  int second = (2 * pair + 1 < 9) ? kernel -> coef[2 * pair + 1] : 0;
+  return (short) ((first & 0xff) | ((second & 0xff) << 8));
+}
+
+/*
+each instruction set has one body, which filters a row with COUNT
+kernels: the input pixels are loaded, widened and paired up once, and
+every kernel multiplies the same pairs. A single filter is COUNT 1,
+which inlines to straight-line code. The per-kernel values are copied to
+locals so the stores to the output rows cannot change them.
+*/
+template <int DX>
+__attribute__((target("sse4.1")))
+static inline __attribute__((always_inline)) void
+bankSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+	  const cs1300pixel *below, cs1300pixel *const *outputs,
+	  int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m128i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  bool reciprocal[KERNEL_BANK_MAX];
+  __m128 divisor[KERNEL_BANK_MAX];
+  __m128i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m128i lowByte = _mm_set1_epi32(0xff);
+  __m128i lowByteWords = _mm_set1_epi16(0xff);
+  __m128i zero = _mm_setzero_si128();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm_set1_epi32(pairedCoef(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    reciprocal[k] = kernel -> multiplier != 0;
+    divisor[k] = _mm_set1_ps((float) kernel -> divisor);
+    multiplier[k] = _mm_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 8 <= (width - 1) * DX; col += 8) {
+    __m128i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (rows[r] + col + (dc - 1) * DX)));
+      }
+    }
+    tap[9] = zero;
+    __m128i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm_unpacklo_epi16(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm_unpackhi_epi16(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m128i lo = zero;
+      __m128i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm_add_epi32(lo, _mm_madd_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm_add_epi32(hi, _mm_madd_epi16(pairHi[pair], coef[k][pair]));
+      }
+
+      __m128i words;
+      if ( divide[k] && reciprocal[k] ) {
+	//
+	// |sum| fits in 16 bits, so the quotient is a multiply high and a
+	// shift of |sum|, with the sign put back after
+	//
+	words = _mm_packs_epi32(lo, hi);
+	__m128i quotient = _mm_srl_epi16(_mm_mulhi_epu16(_mm_abs_epi16(words), multiplier[k]), shift[k]);
+	words = _mm_and_si128(_mm_sign_epi16(quotient, words), lowByteWords);
+      } else {
+	if ( divide[k] ) {
+	  lo = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(lo), divisor[k])), lowByte);
+	  hi = _mm_and_si128(_mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(hi), divisor[k])), lowByte);
+	}
+	words = _mm_packs_epi32(lo, hi);
+      }
+      //
+      // The saturating packs are the clamp to 0..255
+      //
+      _mm_storel_epi64((__m128i *) (out[k] + col), _mm_packus_epi16(words, words));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+template <int DX>
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void
+bankAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+	 const cs1300pixel *below, cs1300pixel *const *outputs,
+	 int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m256i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  bool reciprocal[KERNEL_BANK_MAX];
+  __m256 divisor[KERNEL_BANK_MAX];
+  __m256i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m256i lowByte = _mm256_set1_epi32(0xff);
+  __m256i lowByteWords = _mm256_set1_epi16(0xff);
+  __m256i zero = _mm256_setzero_si256();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm256_set1_epi32(pairedCoef(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    reciprocal[k] = kernel -> multiplier != 0;
+    divisor[k] = _mm256_set1_ps((float) kernel -> divisor);
+    multiplier[k] = _mm256_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 16 <= (width - 1) * DX; col += 16) {
+    __m256i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (rows[r] + col + (dc - 1) * DX)));
+      }
+    }
+    tap[9] = zero;
+    //
+    // Unpacking works within 128-bit lanes, so lo holds pixels 0-3 and
+    // 8-11 and hi holds 4-7 and 12-15; the pack below puts them back
+    // in order
+    //
+    __m256i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm256_unpacklo_epi16(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm256_unpackhi_epi16(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m256i lo = zero;
+      __m256i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm256_add_epi32(lo, _mm256_madd_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm256_add_epi32(hi, _mm256_madd_epi16(pairHi[pair], coef[k][pair]));
+      }
+
+      __m256i words;
+      if ( divide[k] && reciprocal[k] ) {
+	words = _mm256_packs_epi32(lo, hi);
+	__m256i quotient = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_abs_epi16(words), multiplier[k]), shift[k]);
+	words = _mm256_and_si256(_mm256_sign_epi16(quotient, words), lowByteWords);
+      } else {
+	if ( divide[k] ) {
+	  lo = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(lo), divisor[k])), lowByte);
+	  hi = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(hi), divisor[k])), lowByte);
+	}
+	words = _mm256_packs_epi32(lo, hi);
+      }
+      __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+      _mm_storeu_si128((__m128i *) (out[k] + col), _mm256_castsi256_si128(bytes));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+//
+// GCC's AVX-512 headers start some conversions from a deliberately
+// undefined register, which -Wall reports as maybe uninitialized
+//
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+template <int DX>
+__attribute__((target("avx512f,avx512bw")))
+static inline __attribute__((always_inline)) void
+bankAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+	   const cs1300pixel *below, cs1300pixel *const *outputs,
+	   int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m512i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  bool reciprocal[KERNEL_BANK_MAX];
+  __m512 divisor[KERNEL_BANK_MAX];
+  __m512i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m512i lowByte = _mm512_set1_epi32(0xff);
+  __m512i lowByteWords = _mm512_set1_epi16(0xff);
+  __m512i zero = _mm512_setzero_si512();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm512_set1_epi32(pairedCoef(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    reciprocal[k] = kernel -> multiplier != 0;
+    divisor[k] = _mm512_set1_ps((float) kernel -> divisor);
+    multiplier[k] = _mm512_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 32 <= (width - 1) * DX; col += 32) {
+    __m512i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *) (rows[r] + col + (dc - 1) * DX)));
+      }
+    }
+    tap[9] = zero;
+    __m512i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm512_unpacklo_epi16(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm512_unpackhi_epi16(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m512i lo = zero;
+      __m512i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm512_add_epi32(lo, _mm512_madd_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm512_add_epi32(hi, _mm512_madd_epi16(pairHi[pair], coef[k][pair]));
+      }
+
+      __m512i words;
+      if ( divide[k] && reciprocal[k] ) {
+	//
+	// There is no 512-bit sign instruction, so negative sums get
+	// their quotient subtracted from 0 under a mask instead
+	//
+	words = _mm512_packs_epi32(lo, hi);
+	__m512i quotient = _mm512_srl_epi16(_mm512_mulhi_epu16(_mm512_abs_epi16(words), multiplier[k]), shift[k]);
+	quotient = _mm512_mask_sub_epi16(quotient, _mm512_movepi16_mask(words), zero, quotient);
+	words = _mm512_and_si512(quotient, lowByteWords);
+      } else {
+	if ( divide[k] ) {
+	  lo = _mm512_and_si512(_mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(lo), divisor[k])), lowByte);
+	  hi = _mm512_and_si512(_mm512_cvttps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(hi), divisor[k])), lowByte);
+	}
+	//
+	// Within each 128-bit lane the pack restores pixel order; clamping
+	// at 0 first lets the unsigned saturating narrow finish the clamp
+	//
+	words = _mm512_max_epi16(_mm512_packs_epi32(lo, hi), zero);
+      }
+      _mm256_storeu_si256((__m256i *) (out[k] + col), _mm512_cvtusepi16_epi8(words));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+/*
+the narrow bodies, for banks of kernels that are all narrow. Taps are
+paired up as bytes, so one multiply-add gives the 16-bit sums of a whole
+vector of pixels' pairs, and a pass does twice the pixels of the bodies
+above. The range analysis guarantees no sum, or part of one, leaves 16
+bits, so neither the saturating multiply-add nor the wrapping adds ever
+change a sum.
+*/
+template <int DX>
+__attribute__((target("sse4.1")))
+static inline __attribute__((always_inline)) void
+narrowSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+	    const cs1300pixel *below, cs1300pixel *const *outputs,
+	    int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m128i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  __m128i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m128i lowByteWords = _mm_set1_epi16(0xff);
+  __m128i zero = _mm_setzero_si128();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm_set1_epi16(pairedBytes(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    multiplier[k] = _mm_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 16 <= (width - 1) * DX; col += 16) {
+    __m128i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm_loadu_si128((const __m128i *) (rows[r] + col + (dc - 1) * DX));
+      }
+    }
+    tap[9] = zero;
+    __m128i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm_unpacklo_epi8(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm_unpackhi_epi8(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m128i lo = zero;
+      __m128i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm_add_epi16(lo, _mm_maddubs_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm_add_epi16(hi, _mm_maddubs_epi16(pairHi[pair], coef[k][pair]));
+      }
+      if ( divide[k] ) {
+	__m128i quotient = _mm_srl_epi16(_mm_mulhi_epu16(_mm_abs_epi16(lo), multiplier[k]), shift[k]);
+	lo = _mm_and_si128(_mm_sign_epi16(quotient, lo), lowByteWords);
+	quotient = _mm_srl_epi16(_mm_mulhi_epu16(_mm_abs_epi16(hi), multiplier[k]), shift[k]);
+	hi = _mm_and_si128(_mm_sign_epi16(quotient, hi), lowByteWords);
+      }
+      _mm_storeu_si128((__m128i *) (out[k] + col), _mm_packus_epi16(lo, hi));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+template <int DX>
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void
+narrowAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+	   const cs1300pixel *below, cs1300pixel *const *outputs,
+	   int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m256i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  __m256i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m256i lowByteWords = _mm256_set1_epi16(0xff);
+  __m256i zero = _mm256_setzero_si256();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm256_set1_epi16(pairedBytes(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    multiplier[k] = _mm256_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 32 <= (width - 1) * DX; col += 32) {
+    __m256i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm256_loadu_si256((const __m256i *) (rows[r] + col + (dc - 1) * DX));
+      }
+    }
+    tap[9] = zero;
+    //
+    // The unpacks and the pack both work within 128-bit lanes, so the
+    // pixels come out in order with no permute
+    //
+    __m256i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm256_unpacklo_epi8(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm256_unpackhi_epi8(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m256i lo = zero;
+      __m256i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm256_add_epi16(lo, _mm256_maddubs_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm256_add_epi16(hi, _mm256_maddubs_epi16(pairHi[pair], coef[k][pair]));
+      }
+      if ( divide[k] ) {
+	__m256i quotient = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_abs_epi16(lo), multiplier[k]), shift[k]);
+	lo = _mm256_and_si256(_mm256_sign_epi16(quotient, lo), lowByteWords);
+	quotient = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_abs_epi16(hi), multiplier[k]), shift[k]);
+	hi = _mm256_and_si256(_mm256_sign_epi16(quotient, hi), lowByteWords);
+      }
+      _mm256_storeu_si256((__m256i *) (out[k] + col), _mm256_packus_epi16(lo, hi));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+template <int DX>
+__attribute__((target("avx512f,avx512bw")))
+static inline __attribute__((always_inline)) void
+narrowAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+	     const cs1300pixel *below, cs1300pixel *const *outputs,
+	     int width, const Kernel3x3 *kernels, int count)
+{
+  const cs1300pixel *rows[3] = { above, middle, below };
+  cs1300pixel *out[KERNEL_BANK_MAX];
+  __m512i coef[KERNEL_BANK_MAX][5];
+  bool divide[KERNEL_BANK_MAX];
+  __m512i multiplier[KERNEL_BANK_MAX];
+  __m128i shift[KERNEL_BANK_MAX];
+  __m512i lowByteWords = _mm512_set1_epi16(0xff);
+  __m512i zero = _mm512_setzero_si512();
+
+  for (int k = 0; k < count; k++) {
+    const Kernel3x3 *kernel = &kernels[k];
+    out[k] = outputs[k];
+    for (int pair = 0; pair < 5; pair++) {
+      coef[k][pair] = _mm512_set1_epi16(pairedBytes(kernel, pair));
+    }
+    divide[k] = kernel -> divisor > 1;
+    multiplier[k] = _mm512_set1_epi16((short) kernel -> multiplier);
+    shift[k] = _mm_cvtsi32_si128(kernel -> shift);
+    for (int i = 0; i < DX; i++) {
+      out[k][i] = 0;
+      out[k][width * DX - 1 - i] = 0;
+    }
+  }
+
+  int col = DX;
+  for ( ; col + 64 <= (width - 1) * DX; col += 64) {
+    __m512i tap[10];
+    for (int r = 0; r < 3; r++) {
+      for (int dc = 0; dc < 3; dc++) {
+	tap[r * 3 + dc] = _mm512_loadu_si512((const void *) (rows[r] + col + (dc - 1) * DX));
+      }
+    }
+    tap[9] = zero;
+    __m512i pairLo[5], pairHi[5];
+    for (int pair = 0; pair < 5; pair++) {
+      pairLo[pair] = _mm512_unpacklo_epi8(tap[2 * pair], tap[2 * pair + 1]);
+      pairHi[pair] = _mm512_unpackhi_epi8(tap[2 * pair], tap[2 * pair + 1]);
+    }
+
+    for (int k = 0; k < count; k++) {
+      __m512i lo = zero;
+      __m512i hi = zero;
+      for (int pair = 0; pair < 5; pair++) {
+	lo = _mm512_add_epi16(lo, _mm512_maddubs_epi16(pairLo[pair], coef[k][pair]));
+	hi = _mm512_add_epi16(hi, _mm512_maddubs_epi16(pairHi[pair], coef[k][pair]));
+      }
+      if ( divide[k] ) {
+	__m512i quotient = _mm512_srl_epi16(_mm512_mulhi_epu16(_mm512_abs_epi16(lo), multiplier[k]), shift[k]);
+	quotient = _mm512_mask_sub_epi16(quotient, _mm512_movepi16_mask(lo), zero, quotient);
+	lo = _mm512_and_si512(quotient, lowByteWords);
+	quotient = _mm512_srl_epi16(_mm512_mulhi_epu16(_mm512_abs_epi16(hi), multiplier[k]), shift[k]);
+	quotient = _mm512_mask_sub_epi16(quotient, _mm512_movepi16_mask(hi), zero, quotient);
+	hi = _mm512_and_si512(quotient, lowByteWords);
+      }
+      _mm512_storeu_si512((void *) (out[k] + col), _mm512_packus_epi16(lo, hi));
+    }
+  }
+  for (int k = 0; k < count; k++) {
+    filterTail<DX>(above, middle, below, out[k], col, width, &kernels[k]);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterRowSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+	       const cs1300pixel *below, cs1300pixel *out,
+	       int width, const Kernel3x3 *kernel)
+{
+  bankSSE41<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx2")))
+static void
+filterRowAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+	      const cs1300pixel *below, cs1300pixel *out,
+	      int width, const Kernel3x3 *kernel)
+{
+  bankAVX2<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterRowAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+		const cs1300pixel *below, cs1300pixel *out,
+		int width, const Kernel3x3 *kernel)
+{
+  bankAVX512<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterBankSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+		const cs1300pixel *below, cs1300pixel *const *out,
+		int width, const Kernel3x3 *kernels, int count)
+{
+  bankSSE41<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("avx2")))
+static void
+filterBankAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+	       const cs1300pixel *below, cs1300pixel *const *out,
+	       int width, const Kernel3x3 *kernels, int count)
+{
+  bankAVX2<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterBankAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+		 const cs1300pixel *below, cs1300pixel *const *out,
+		 int width, const Kernel3x3 *kernels, int count)
+{
+  bankAVX512<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterRowInterleavedSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+			  const cs1300pixel *below, cs1300pixel *out,
+			  int width, const Kernel3x3 *kernel)
+{
+  bankSSE41<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx2")))
+static void
+filterRowInterleavedAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+			 const cs1300pixel *below, cs1300pixel *out,
+			 int width, const Kernel3x3 *kernel)
+{
+  bankAVX2<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterRowInterleavedAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+			   const cs1300pixel *below, cs1300pixel *out,
+			   int width, const Kernel3x3 *kernel)
+{
+  bankAVX512<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterRowNarrowSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+		     const cs1300pixel *below, cs1300pixel *out,
+		     int width, const Kernel3x3 *kernel)
+{
+  narrowSSE41<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx2")))
+static void
+filterRowNarrowAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+		    const cs1300pixel *below, cs1300pixel *out,
+		    int width, const Kernel3x3 *kernel)
+{
+  narrowAVX2<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterRowNarrowAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+		      const cs1300pixel *below, cs1300pixel *out,
+		      int width, const Kernel3x3 *kernel)
+{
+  narrowAVX512<1>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterBankNarrowSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+		      const cs1300pixel *below, cs1300pixel *const *out,
+		      int width, const Kernel3x3 *kernels, int count)
+{
+  narrowSSE41<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("avx2")))
+static void
+filterBankNarrowAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+		     const cs1300pixel *below, cs1300pixel *const *out,
+		     int width, const Kernel3x3 *kernels, int count)
+{
+  narrowAVX2<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterBankNarrowAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+		       const cs1300pixel *below, cs1300pixel *const *out,
+		       int width, const Kernel3x3 *kernels, int count)
+{
+  narrowAVX512<1>(above, middle, below, out, width, kernels, count);
+}
+
+__attribute__((target("sse4.1")))
+static void
+filterRowInterleavedNarrowSSE41(const cs1300pixel *above, const cs1300pixel *middle,
+				const cs1300pixel *below, cs1300pixel *out,
+				int width, const Kernel3x3 *kernel)
+{
+  narrowSSE41<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx2")))
+static void
+filterRowInterleavedNarrowAVX2(const cs1300pixel *above, const cs1300pixel *middle,
+			       const cs1300pixel *below, cs1300pixel *out,
+			       int width, const Kernel3x3 *kernel)
+{
+  narrowAVX2<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterRowInterleavedNarrowAVX512(const cs1300pixel *above, const cs1300pixel *middle,
+				 const cs1300pixel *below, cs1300pixel *out,
+				 int width, const Kernel3x3 *kernel)
+{
+  narrowAVX512<3>(above, middle, below, &out, width, kernel, 1);
+}
+
+#pragma GCC diagnostic pop
+
+//
+// Without vectors a bank is each filter in turn; the three input rows
+// stay in L1 between them
+//
+static void
+filterBankScalar(const cs1300pixel *above, const cs1300pixel *middle,
+		 const cs1300pixel *below, cs1300pixel *const *out,
+		 int width, const Kernel3x3 *kernels, int count)
+{
+  for (int k = 0; k < count; k++) {
+    filterRowScalar(above, middle, below, out[k], width, &kernels[k]);
+  }
+}
+
+//
+// True if the vector paths give the reference result for KERNEL: pixels
+// must be bytes, the coefficients must fit pmaddwd's 16 bits, and any
+// sum must be small enough to divide exactly in single precision
+//
+static bool
+vectorExact(const Kernel3x3 *kernel)
+{
+  if ( sizeof(cs1300pixel) != 1 ) {
+    return false;
+  }
+  long long reach = 0;
+  for (int i = 0; i < 9; i++) {
+    int c = kernel -> coef[i];
+    if ( c < -32768 || c > 32767 ) {
+      return false;
+    }
+    reach += 255LL * (c < 0 ? -c : c);
+  }
+  return reach < (1 << 24);
+}
+
+BankFilter3x3
+bankFilter3x3(KernelPath path, const Kernel3x3 *kernels, int count)
+{
+  bool narrow = true;
+  for (int k = 0; k < count; k++) {
+    if ( ! vectorExact(&kernels[k]) ) {
+      path = KERNEL_SCALAR;
+    }
+    narrow = narrow && kernels[k].narrow;
+  }
+  if ( narrow ) {
+    switch ( path ) {
+    case KERNEL_AVX512:
+      return filterBankNarrowAVX512;
+    case KERNEL_AVX2:
+      return filterBankNarrowAVX2;
+    case KERNEL_SSE41:
+      return filterBankNarrowSSE41;
+    default:
+      break;
+    }
+  }
+  switch ( path ) {
+  case KERNEL_AVX512:
+    return filterBankAVX512;
+  case KERNEL_AVX2:
+    return filterBankAVX2;
+  case KERNEL_SSE41:
+    return filterBankSSE41;
+  default:
+    return filterBankScalar;
+  }
+}
+
+RowFilter3x3
+rowFilter3x3(KernelPath path, const Kernel3x3 *kernel)
+{
+  if ( ! vectorExact(kernel) ) {
+    path = KERNEL_SCALAR;
+  }
+  if ( kernel -> narrow ) {
+    switch ( path ) {
+    case KERNEL_AVX512:
+      return filterRowNarrowAVX512;
+    case KERNEL_AVX2:
+      return filterRowNarrowAVX2;
+    case KERNEL_SSE41:
+      return filterRowNarrowSSE41;
+    default:
+      break;
+    }
+  }
+  switch ( path ) {
+  case KERNEL_AVX512:
+    return filterRowAVX512;
+  case KERNEL_AVX2:
+    return filterRowAVX2;
+  case KERNEL_SSE41:
+    return filterRowSSE41;
+  default:
+    return filterRowScalar;
+  }
+}
+
+RowFilter3x3
+rowFilter3x3Interleaved(KernelPath path, const Kernel3x3 *kernel)
+{
+  if ( sizeof(cs1300pixel) != 1 ) {
+    return NULL;
+  }
+  if ( ! vectorExact(kernel) ) {
+    path = KERNEL_SCALAR;
+  }
+  if ( kernel -> narrow ) {
+    switch ( path ) {
+    case KERNEL_AVX512:
+      return filterRowInterleavedNarrowAVX512;
+    case KERNEL_AVX2:
+      return filterRowInterleavedNarrowAVX2;
+    case KERNEL_SSE41:
+      return filterRowInterleavedNarrowSSE41;
+    default:
+      break;
+    }
+  }
+  switch ( path ) {
+  case KERNEL_AVX512:
+    return filterRowInterleavedAVX512;
+  case KERNEL_AVX2:
+    return filterRowInterleavedAVX2;
+  case KERNEL_SSE41:
+    return filterRowInterleavedSSE41;
+  default:
+    return filterRowInterleavedScalar;
+  }
+}
+
+void
+kernelLoadNxN(Filter *filter, KernelNxN *kernel)
+{
+  int size = filter -> getSize();
+  int radius = size / 2;
+  kernel -> size = size;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      kernel -> coef[i * size + j] = filter -> get(i, j);
+    }
+  }
+  kernel -> divisor = filter -> getDivisor();
+
+  //
+  // Keep the nonzero taps, and add up the most negative and most
+  // positive sums that pixels of 0..255 can give
+  //
+  long long minSum = 0, maxSum = 0;
+  kernel -> taps = 0;
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      int c = kernel -> coef[i * size + j];
+      if ( c == 0 ) {
+	continue;
+      }
+      kernel -> tapRow[kernel -> taps] = i;
+      kernel -> tapCol[kernel -> taps] = j;
+      kernel -> tapCoef[kernel -> taps] = c;
+      kernel -> taps++;
+      if ( c < 0 ) {
+	minSum += 255LL * c;
+      } else {
+	maxSum += 255LL * c;
+      }
+    }
+  }
+  long long reach = max(-minSum, maxSum);
+  kernel -> floatExact = reach < (1 << 24);
+
+  int divisor = kernel -> divisor;
+  kernel -> shift = 0;
+  kernel -> multiplier = 0;
+  if ( divisor <= 1 ) {
+    kernel -> finish = (minSum >= 0 && maxSum <= 255) ? FINISH_NONE : FINISH_CLAMP;
+  } else if ( (divisor & (divisor - 1)) == 0 ) {
+    kernel -> finish = FINISH_SHIFT;
+    while ( (1 << kernel -> shift) < divisor ) {
+      kernel -> shift++;
+    }
+  } else if ( reach <= 0x7fffffff
+	      && findReciprocal(divisor, reach, 0, 0xffffffffULL, &kernel -> multiplier, &kernel -> shift) ) {
+    kernel -> finish = FINISH_RECIPROCAL;
+  } else {
+    kernel -> finish = FINISH_DIVIDE;
+  }
+
+  kernel -> identity = kernel -> taps == 1 && kernel -> finish == FINISH_NONE
+    && kernel -> tapRow[0] == radius && kernel -> tapCol[0] == radius
+    && kernel -> tapCoef[0] == 1;
+}
+
+//
+// What finishPixel needs, copied out of the kernel so that stores to
+// the output cannot alias it
+//
+struct Finish {
+  int divisor;
+  float floatDivisor;
+  int shift;
+  unsigned long long multiplier;
+};
+
+/*
+turns a sum into an output pixel. F is a constant at every call, so
+each column loop has exactly one way of finishing in it. All of them
+give what the reference gives: the truncated quotient when there is a
+divisor, else the sum clamped to 0..255.
+*/
+template <KernelFinish F>
+static inline __attribute__((always_inline)) cs1300pixel
+finishPixel(cs1300accum value, const Finish &finish)
+{
+  switch ( F ) {
+  case FINISH_CLAMP:
+    value = value < 0 ? 0 : value;
+    value = value > 255 ? 255 : value;
+    break;
+  case FINISH_SHIFT:
+    /*a shift rounds down, so negative sums get divisor-1 added first to round toward 0 like / does*/
+    value = (value + ((value >> 31) & (finish.divisor - 1))) >> finish.shift;
+    break;
+  case FINISH_RECIPROCAL: {
+    unsigned long long magnitude = value < 0 ? -(long long) value : value;
+    int quotient = (int) ((magnitude * finish.multiplier) >> finish.shift);
+    value = value < 0 ? -quotient : quotient;
+    break;
+  }
+  case FINISH_FLOAT:
+    value = (int) ((float) value / finish.floatDivisor);
+    break;
+  case FINISH_DIVIDE:
+    value /= finish.divisor;
+    break;
+  default:
+    break;
+  }
+  return (cs1300pixel) value;
+}
+
+/*
+sum of the taps for output column COL. N is the size when it is known
+at compile time, so the loops unroll completely, or 0 to use SIZE
+*/
+template <int N, int STEP, class Pixel>
+static inline __attribute__((always_inline)) cs1300accum
+tapSum(const Pixel *const *rows, const int *coef, int size, int col)
+{
+  cs1300accum value = 0;
+#pragma GCC unroll 7
+  for (int i = 0; i < (N ? N : size); i++) {
+#pragma GCC unroll 7
+    for (int j = 0; j < (N ? N : size); j++) {
+      value += rows[i][(col + j) * STEP] * coef[i * (N ? N : size) + j];
+    }
+  }
+  return value;
+}
+
+template <int N, int STEP, KernelFinish F, class Pixel>
+static inline __attribute__((always_inline)) void
+filterSpanUnrolled(const Pixel *const *rows, cs1300pixel *__restrict out,
+		   int colStart, int colEnd, const int *coef, const Finish &finish)
+{
+  for (int col = colStart; col < colEnd; col++) {
+    out[col] = finishPixel<F>(tapSum<N, STEP>(rows, coef, N, col), finish);
+  }
+}
+
+/*
+the generic size. The sums for a chunk of columns are built up one
+nonzero tap at a time, so the inner loop runs across columns and
+vectorizes whatever the size.
+*/
+template <int STEP, KernelFinish F, class Pixel>
+static inline __attribute__((always_inline)) void
+filterSpanTaps(const Pixel *const *rows, cs1300pixel *__restrict out,
+	       int colStart, int colEnd, const KernelNxN *kernel, const Finish &finish)
+{
+  const int chunk = 256;
+  cs1300accum sums[chunk];
+
+  for (int start = colStart; start < colEnd; start += chunk) {
+    int count = min(chunk, colEnd - start);
+    for (int col = 0; col < count; col++) {
+      sums[col] = 0;
+    }
+    for (int tap = 0; tap < kernel -> taps; tap++) {
+      int c = kernel -> tapCoef[tap];
+      const Pixel *in = rows[kernel -> tapRow[tap]] + (start + kernel -> tapCol[tap]) * STEP;
+      for (int col = 0; col < count; col++) {
+	sums[col] += in[col * STEP] * c;
+      }
+    }
+    for (int col = 0; col < count; col++) {
+      out[start + col] = finishPixel<F>(sums[col], finish);
+    }
+  }
+}
+
+template <int N, int STEP, KernelFinish F, class Pixel>
+static inline __attribute__((always_inline)) void
+filterSpanFinish(const Pixel *const *rows, cs1300pixel *out, int colStart, int colEnd,
+		 const KernelNxN *kernel, const int *coef, const Finish &finish)
+{
+  if ( N == 0 ) {
+    filterSpanTaps<STEP, F>(rows, out, colStart, colEnd, kernel, finish);
+  } else {
+    filterSpanUnrolled<N, STEP, F>(rows, out, colStart, colEnd, coef, finish);
+  }
+}
+
+/*
+N x N version of filterSpan, run the way kernelLoadNxN planned it. N = 0
+means the generic size. The coefficients and row pointers are copied to
+locals so the compiler knows the stores to out cannot change them.
+With VECTOR set, a divide is done in single precision when that is
+exact, since the column loops vectorize that better than a 64-bit
+multiply.
+*/
+template <int N, int STEP, bool VECTOR, class Pixel>
+static inline __attribute__((always_inline)) void
+filterSpanN(const Pixel *const *inputRows, cs1300pixel *out,
+	    int colStart, int colEnd, const KernelNxN *kernel)
+{
+  const int size = N ? N : kernel -> size;
+  const int radius = size / 2;
+  int coef[N ? N * N : 1];
+  const Pixel *rows[N ? N : KERNEL_MAX_SIZE];
+  Finish finish = { kernel -> divisor, (float) kernel -> divisor,
+		    kernel -> shift, kernel -> multiplier };
+
+  for (int i = 0; i < size; i++) {
+    rows[i] = inputRows[i] - radius * STEP;
+  }
+  for (int i = 0; i < N * N; i++) {
+    coef[i] = kernel -> coef[i];
+  }
+
+  KernelFinish how = kernel -> finish;
+  if ( VECTOR && kernel -> floatExact && (how == FINISH_RECIPROCAL || how == FINISH_DIVIDE) ) {
+    how = FINISH_FLOAT;
+  }
+  switch ( how ) {
+  case FINISH_NONE:
+    filterSpanFinish<N, STEP, FINISH_NONE>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  case FINISH_CLAMP:
+    filterSpanFinish<N, STEP, FINISH_CLAMP>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  case FINISH_SHIFT:
+    filterSpanFinish<N, STEP, FINISH_SHIFT>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  case FINISH_RECIPROCAL:
+    filterSpanFinish<N, STEP, FINISH_RECIPROCAL>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  case FINISH_FLOAT:
+    filterSpanFinish<N, STEP, FINISH_FLOAT>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  default:
+    filterSpanFinish<N, STEP, FINISH_DIVIDE>(rows, out, colStart, colEnd, kernel, coef, finish);
+    break;
+  }
+}
+
+//
+// Zeroes the border columns and returns false if there is no interior
+//
+static bool
+clearBorderColumns(cs1300pixel *out, int width, int radius)
+{
+  if ( width <= 2 * radius ) {
+    memset(out, 0, width * sizeof(cs1300pixel));
+    return false;
+  }
+  memset(out, 0, radius * sizeof(cs1300pixel));
+  memset(out + width - radius, 0, radius * sizeof(cs1300pixel));
+  return true;
+}
+
+template <int N>
+static void
+filterRowNScalar(const cs1300pixel *const *rows, cs1300pixel *out,
+		 int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( clearBorderColumns(out, width, radius) ) {
+    filterSpanN<N, 1, false>(rows, out, radius, width - radius, kernel);
+  }
+}
+
+//
+// The vector versions are the same loops compiled for each instruction
+// set and left for the compiler to vectorize across columns
+//
+template <int N>
+__attribute__((target("sse4.1")))
+static void
+filterRowNSSE41(const cs1300pixel *const *rows, cs1300pixel *out,
+		int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( clearBorderColumns(out, width, radius) ) {
+    filterSpanN<N, 1, true>(rows, out, radius, width - radius, kernel);
+  }
+}
+
+template <int N>
+__attribute__((target("avx2")))
+static void
+filterRowNAVX2(const cs1300pixel *const *rows, cs1300pixel *out,
+	       int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( clearBorderColumns(out, width, radius) ) {
+    filterSpanN<N, 1, true>(rows, out, radius, width - radius, kernel);
+  }
+}
+
+template <int N>
+__attribute__((target("avx512f,avx512bw")))
+static void
+filterRowNAVX512(const cs1300pixel *const *rows, cs1300pixel *out,
+		 int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( clearBorderColumns(out, width, radius) ) {
+    filterSpanN<N, 1, true>(rows, out, radius, width - radius, kernel);
+  }
+}
+
+//
+// An identity filter copies the interior
+//
+static void
+filterRowCopy(const cs1300pixel *const *rows, cs1300pixel *out,
+	      int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( clearBorderColumns(out, width, radius) ) {
+    memcpy(out + radius, rows[radius] + radius, (width - 2 * radius) * sizeof(cs1300pixel));
+  }
+}
+
+template <int N>
+static RowFilterNxN
+rowFilterN(KernelPath path)
+{
+  switch ( path ) {
+  case KERNEL_AVX512:
+    return filterRowNAVX512<N>;
+  case KERNEL_AVX2:
+    return filterRowNAVX2<N>;
+  case KERNEL_SSE41:
+    return filterRowNSSE41<N>;
+  default:
+    return filterRowNScalar<N>;
+  }
+}
+
+RowFilterNxN
+rowFilterNxN(KernelPath path, const KernelNxN *kernel)
+{
+  if ( kernel -> identity ) {
+    return filterRowCopy;
+  }
+  //
+  // Without vectors, skipping the zero taps is worth more than having
+  // the loops unrolled
+  //
+  if ( path == KERNEL_SCALAR && kernel -> taps < kernel -> size * kernel -> size ) {
+    return rowFilterN<0>(path);
+  }
+  switch ( kernel -> size ) {
+  case 3:
+    return rowFilterN<3>(path);
+  case 5:
+    return rowFilterN<5>(path);
+  case 7:
+    return rowFilterN<7>(path);
+  default:
+    return rowFilterN<0>(path);
+  }
+}
+
+void
+filterRowNxNInterleaved(const unsigned char *const *rows, cs1300pixel *out,
+			int width, const KernelNxN *kernel)
+{
+  int radius = kernel -> size / 2;
+  if ( ! clearBorderColumns(out, width, radius) ) {
+    return;
+  }
+  if ( kernel -> taps < kernel -> size * kernel -> size ) {
+    filterSpanN<0, 3, false>(rows, out, radius, width - radius, kernel);
+    return;
+  }
+  switch ( kernel -> size ) {
+  case 3:
+    filterSpanN<3, 3, false>(rows, out, radius, width - radius, kernel);
+    break;
+  case 5:
+    filterSpanN<5, 3, false>(rows, out, radius, width - radius, kernel);
+    break;
+  case 7:
+    filterSpanN<7, 3, false>(rows, out, radius, width - radius, kernel);
+    break;
+  default:
+    filterSpanN<0, 3, false>(rows, out, radius, width - radius, kernel);
+    break;
+  }
+}
+
+void
+filterStageLoad(KernelPath path, Filter *filter, FilterStage *stage)
+{
+  stage -> radius = filter -> getSize() / 2;
+  kernelLoadNxN(filter, &stage -> kernelN);
+  stage -> filterRowN = rowFilterNxN(path, &stage -> kernelN);
+  stage -> filterRow = NULL;
+  if ( stage -> radius == 1 && ! stage -> kernelN.identity ) {
+    kernelLoad3x3(filter, &stage -> kernel);
+    stage -> filterRow = rowFilter3x3(path, &stage -> kernel);
+    if ( stage -> filterRow == filterRowScalar ) {
+      stage -> filterRow = NULL;
+    }
+  }
+}
+
+void
+filterStageRow(const FilterStage *stage, const cs1300pixel *const *rows,
+	       cs1300pixel *out, int width)
+{
+  if ( stage -> filterRow ) {
+    stage -> filterRow(rows[0], rows[1], rows[2], out, width, &stage -> kernel);
+  } else {
+    stage -> filterRowN(rows, out, width, &stage -> kernelN);
+  }
+}
+
+bool
+kernelLoadSeparable(KernelPath path, Filter *filter, const KernelNxN *plan, KernelSeparable *kernel)
+{
+  if ( ! filter -> isSeparable() || plan -> identity ) {
+    return false;
+  }
+  int size = filter -> getSize();
+  long long rowReach = 0;
+  kernel -> size = size;
+  for (int i = 0; i < size; i++) {
+    kernel -> row[i] = filter -> getRowFactor(i);
+    kernel -> col[i] = filter -> getColFactor(i);
+    rowReach += 255LL * abs(kernel -> row[i]);
+  }
+  kernel -> narrow = rowReach <= 32767;
+  kernel -> path = path;
+  //
+  // Any sum of the vertical pass is a sum of products of the 2D filter,
+  // so the plan's way of finishing is exact here too
+  //
+  kernel -> divisor = plan -> divisor;
+  kernel -> finish = plan -> finish;
+  kernel -> shift = plan -> shift;
+  kernel -> multiplier = plan -> multiplier;
+  if ( path != KERNEL_SCALAR && plan -> floatExact
+       && (kernel -> finish == FINISH_RECIPROCAL || kernel -> finish == FINISH_DIVIDE) ) {
+    kernel -> finish = FINISH_FLOAT;
+  }
+  return rowReach <= 0x7fffffff;
+}
+
+size_t
+separableScratchSize(int size, int width)
+{
+  return (size_t) size * width * sizeof(int);
+}
+
+/*
+horizontal sums of one input row, for columns size/2 .. width-size/2-1;
+the others are never read. SUM is the type of the sums. N is the size
+when it is known at compile time, so the taps unroll and the column
+loop vectorizes; N = 0 adds one tap at a time across the row instead.
+*/
+template <int N, class Sum>
+static inline __attribute__((always_inline)) void
+horizontalPass(const cs1300pixel *in, Sum *__restrict sums, int width,
+	       const KernelSeparable *kernel)
+{
+  const int size = N ? N : kernel -> size;
+  const int radius = size / 2;
+  int row[N ? N : KERNEL_MAX_SIZE];
+  for (int j = 0; j < size; j++) {
+    row[j] = kernel -> row[j];
+  }
+  in -= radius;
+
+  if ( N ) {
+    for (int col = radius; col < width - radius; col++) {
+      cs1300accum value = 0;
+#pragma GCC unroll 7
+      for (int j = 0; j < N; j++) {
+	value += row[j] * in[col + j];
+      }
+      sums[col] = value;
+    }
+  } else {
+    for (int col = radius; col < width - radius; col++) {
+      sums[col] = row[0] * in[col];
+    }
+    for (int j = 1; j < size; j++) {
+      int r = row[j];
+      for (int col = radius; col < width - radius; col++) {
+	sums[col] += r * in[col + j];
+      }
+    }
+  }
+}
+
+/*
+one output row from the horizontal sums of the size input rows around
+it; rows[i] holds those of input row (row - size/2 + i)
+*/
+template <int N, KernelFinish F, class Sum>
+static inline __attribute__((always_inline)) void
+verticalPass(const Sum *const *inputRows, cs1300pixel *__restrict out, int width,
+	     const KernelSeparable *kernel)
+{
+  const int size = N ? N : kernel -> size;
+  const int radius = size / 2;
+  int col[N ? N : KERNEL_MAX_SIZE];
+  const Sum *rows[N ? N : KERNEL_MAX_SIZE];
+  Finish finish = { kernel -> divisor, (float) kernel -> divisor,
+		    kernel -> shift, kernel -> multiplier };
+  for (int i = 0; i < size; i++) {
+    col[i] = kernel -> col[i];
+    rows[i] = inputRows[i];
+  }
+
+  if ( N ) {
+    for (int c = radius; c < width - radius; c++) {
+      cs1300accum value = 0;
+#pragma GCC unroll 7
+      for (int i = 0; i < N; i++) {
+	value += col[i] * rows[i][c];
+      }
+      out[c] = finishPixel<F>(value, finish);
+    }
+    return;
+  }
+  //
+  // The generic size builds up a chunk of columns a row at a time, as
+  // filterSpanTaps does
+  //
+  const int chunk = 256;
+  cs1300accum sums[chunk];
+  for (int start = radius; start < width - radius; start += chunk) {
+    int count = min(chunk, width - radius - start);
+    for (int c = 0; c < count; c++) {
+      sums[c] = 0;
+    }
+    for (int i = 0; i < size; i++) {
+      const Sum *in = rows[i] + start;
+      int factor = col[i];
+      for (int c = 0; c < count; c++) {
+	sums[c] += factor * in[c];
+      }
+    }
+    for (int c = 0; c < count; c++) {
+      out[start + c] = finishPixel<F>(sums[c], finish);
+    }
+  }
+}
+
+template <int N, class Sum>
+static inline __attribute__((always_inline)) void
+verticalPassFinish(const Sum *const *rows, cs1300pixel *out, int width,
+		   const KernelSeparable *kernel)
+{
+  switch ( kernel -> finish ) {
+  case FINISH_NONE:
+    verticalPass<N, FINISH_NONE>(rows, out, width, kernel);
+    break;
+  case FINISH_CLAMP:
+    verticalPass<N, FINISH_CLAMP>(rows, out, width, kernel);
+    break;
+  case FINISH_SHIFT:
+    verticalPass<N, FINISH_SHIFT>(rows, out, width, kernel);
+    break;
+  case FINISH_RECIPROCAL:
+    verticalPass<N, FINISH_RECIPROCAL>(rows, out, width, kernel);
+    break;
+  case FINISH_FLOAT:
+    verticalPass<N, FINISH_FLOAT>(rows, out, width, kernel);
+    break;
+  default:
+    verticalPass<N, FINISH_DIVIDE>(rows, out, width, kernel);
+    break;
+  }
+}
+
+template <int N, class Sum>
+static inline __attribute__((always_inline)) void
+bandSeparable(cs1300image *input, cs1300image *output, int plane,
+	      int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  const int size = N ? N : kernel -> size;
+  const int radius = size / 2;
+  int width = input -> width;
+  const Sum *rows[N ? N : KERNEL_MAX_SIZE];
+
+  if ( first >= last ) {
+    return;
+  }
+  //
+  // The horizontal sums of input row r live in row r % size of the
+  // scratch; all but the last of the first output row's are made first
+  //
+  for (int r = first - radius; r < first + radius; r++) {
+    horizontalPass<N>(cs1300image_row(input, plane, r), scratch + (r % size) * width, width, kernel);
+  }
+  for (int row = first; row < last; row++) {
+    int below = row + radius;
+    horizontalPass<N>(cs1300image_row(input, plane, below), scratch + (below % size) * width,
+		      width, kernel);
+    for (int i = 0; i < size; i++) {
+      rows[i] = scratch + ((row - radius + i) % size) * width;
+    }
+    cs1300pixel *out = cs1300image_row(output, plane, row);
+    if ( clearBorderColumns(out, width, radius) ) {
+      verticalPassFinish<N>(rows, out, width, kernel);
+    }
+  }
+}
+
+template <class Sum>
+static inline __attribute__((always_inline)) void
+bandSeparableSize(cs1300image *input, cs1300image *output, int plane,
+		  int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  switch ( kernel -> size ) {
+  case 3:
+    bandSeparable<3>(input, output, plane, first, last, kernel, scratch);
+    break;
+  case 5:
+    bandSeparable<5>(input, output, plane, first, last, kernel, scratch);
+    break;
+  case 7:
+    bandSeparable<7>(input, output, plane, first, last, kernel, scratch);
+    break;
+  default:
+    bandSeparable<0>(input, output, plane, first, last, kernel, scratch);
+    break;
+  }
+}
+
+//
+// The passes are plain loops; these copies let the compiler vectorize
+// them for each instruction set, since the default build only assumes
+// SSE2
+//
+template <class Sum>
+static void
+bandSeparableBase(cs1300image *input, cs1300image *output, int plane,
+		  int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  bandSeparableSize(input, output, plane, first, last, kernel, scratch);
+}
+
+template <class Sum>
+__attribute__((target("sse4.1")))
+static void
+bandSeparableSSE41(cs1300image *input, cs1300image *output, int plane,
+		   int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  bandSeparableSize(input, output, plane, first, last, kernel, scratch);
+}
+
+template <class Sum>
+__attribute__((target("avx2")))
+static void
+bandSeparableAVX2(cs1300image *input, cs1300image *output, int plane,
+		  int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  bandSeparableSize(input, output, plane, first, last, kernel, scratch);
+}
+
+template <class Sum>
+static void
+bandSeparablePath(cs1300image *input, cs1300image *output, int plane,
+		  int first, int last, const KernelSeparable *kernel, Sum *scratch)
+{
+  switch ( kernel -> path ) {
+  case KERNEL_AVX512:
+  case KERNEL_AVX2:
+    bandSeparableAVX2(input, output, plane, first, last, kernel, scratch);
+    break;
+  case KERNEL_SSE41:
+    bandSeparableSSE41(input, output, plane, first, last, kernel, scratch);
+    break;
+  default:
+    bandSeparableBase(input, output, plane, first, last, kernel, scratch);
+    break;
+  }
+}
+
+void
+filterBandSeparable(cs1300image *input, cs1300image *output, int plane,
+		    int first, int last, const KernelSeparable *kernel, void *scratch)
+{
+  if ( kernel -> narrow ) {
+    bandSeparablePath(input, output, plane, first, last, kernel, (short *) scratch);
+  } else {
+    bandSeparablePath(input, output, plane, first, last, kernel, (int *) scratch);
+  }
+}
+
+bool
+kernelIsBox(Filter *filter, const KernelNxN *kernel)
+{
+  return filter -> isBox() && kernel -> taps > 0;
+}
+
+size_t
+boxScratchSize(int width)
+{
+  return 2 * (size_t) width * sizeof(cs1300accum);
+}
+
+/*
+the box engine. columns[col] is the sum of the size input rows centered
+on the current row; sliding a window of size columns along it gives the
+box sum of each output pixel, which is multiplied by the one coefficient
+and finished as planned. Moving to the next row adds the row entering
+the window and subtracts the one leaving it, so nothing depends on the
+size but the first row of the band.
+*/
+template <int STEP, KernelFinish F, class Pixel>
+static inline __attribute__((always_inline)) void
+boxRows(const Pixel *input, long stride, cs1300image *output, int plane,
+	int first, int last, const KernelNxN *kernel, cs1300accum *scratch)
+{
+  int width = output -> width;
+  int radius = kernel -> size / 2;
+  int coef = kernel -> tapCoef[0];
+  Finish finish = { kernel -> divisor, (float) kernel -> divisor,
+		    kernel -> shift, kernel -> multiplier };
+  cs1300accum *__restrict columns = scratch;
+  cs1300accum *__restrict sums = scratch + width;
+
+  for (int col = 0; col < width; col++) {
+    columns[col] = 0;
+  }
+  for (int row = first - radius; row <= first + radius; row++) {
+    const Pixel *in = input + row * stride;
+    for (int col = 0; col < width; col++) {
+      columns[col] += in[col * STEP];
+    }
+  }
+
+  for (int row = first; row < last; row++) {
+    cs1300pixel *__restrict out = cs1300image_row(output, plane, row);
+
+    if ( clearBorderColumns(out, width, radius) ) {
+      cs1300accum window = 0;
+      for (int col = 0; col < 2 * radius; col++) {
+	window += columns[col];
+      }
+      for (int col = radius; col < width - radius; col++) {
+	window += columns[col + radius];
+	sums[col] = window;
+	window -= columns[col - radius];
+      }
+      for (int col = radius; col < width - radius; col++) {
+	out[col] = finishPixel<F>(coef * sums[col], finish);
+      }
+    }
+
+    if ( row + 1 < last ) {
+      const Pixel *entering = input + (row + radius + 1) * stride;
+      const Pixel *leaving = input + (row - radius) * stride;
+      for (int col = 0; col < width; col++) {
+	columns[col] += entering[col * STEP] - leaving[col * STEP];
+      }
+    }
+  }
+}
+
+template <int STEP, bool VECTOR, class Pixel>
+static inline __attribute__((always_inline)) void
+boxBand(const Pixel *input, long stride, cs1300image *output, int plane,
+	int first, int last, const KernelNxN *kernel, cs1300accum *scratch)
+{
+  KernelFinish how = kernel -> finish;
+  if ( VECTOR && kernel -> floatExact && (how == FINISH_RECIPROCAL || how == FINISH_DIVIDE) ) {
+    how = FINISH_FLOAT;
+  }
+  switch ( how ) {
+  case FINISH_NONE:
+    boxRows<STEP, FINISH_NONE>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  case FINISH_CLAMP:
+    boxRows<STEP, FINISH_CLAMP>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  case FINISH_SHIFT:
+    boxRows<STEP, FINISH_SHIFT>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  case FINISH_RECIPROCAL:
+    boxRows<STEP, FINISH_RECIPROCAL>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  case FINISH_FLOAT:
+    boxRows<STEP, FINISH_FLOAT>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  default:
+    boxRows<STEP, FINISH_DIVIDE>(input, stride, output, plane, first, last, kernel, scratch);
+    break;
+  }
+}
+
+static void
+boxBandBase(const cs1300pixel *input, long stride, cs1300image *output, int plane,
+	    int first, int last, const KernelNxN *kernel, cs1300accum *scratch)
+{
+  boxBand<1, false>(input, stride, output, plane, first, last, kernel, scratch);
+}
+
+__attribute__((target("sse4.1")))
+static void
+boxBandSSE41(const cs1300pixel *input, long stride, cs1300image *output, int plane,
+	     int first, int last, const KernelNxN *kernel, cs1300accum *scratch)
+{
+  boxBand<1, true>(input, stride, output, plane, first, last, kernel, scratch);
+}
+
+__attribute__((target("avx2")))
+static void
+boxBandAVX2(const cs1300pixel *input, long stride, cs1300image *output, int plane,
+	    int first, int last, const KernelNxN *kernel, cs1300accum *scratch)
+{
+  boxBand<1, true>(input, stride, output, plane, first, last, kernel, scratch);
+}
+
+void
+filterBandBox(KernelPath path, const cs1300pixel *input, long stride,
+	      cs1300image *output, int plane, int first, int last,
+	      const KernelNxN *kernel, void *scratch)
+{
+  switch ( path ) {
+  case KERNEL_AVX512:
+  case KERNEL_AVX2:
+    boxBandAVX2(input, stride, output, plane, first, last, kernel, (cs1300accum *) scratch);
+    break;
+  case KERNEL_SSE41:
+    boxBandSSE41(input, stride, output, plane, first, last, kernel, (cs1300accum *) scratch);
+    break;
+  default:
+    boxBandBase(input, stride, output, plane, first, last, kernel, (cs1300accum *) scratch);
+    break;
+  }
+}
+
+void
+filterBandBoxInterleaved(const unsigned char *input, long stride,
+			 cs1300image *output, int plane, int first, int last,
+			 const KernelNxN *kernel, void *scratch)
+{
+  boxBand<3, false>(input, stride, output, plane, first, last, kernel, (cs1300accum *) scratch);
+}
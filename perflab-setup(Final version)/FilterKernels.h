@@ -0,0 +1,305 @@
+//-*-c++-*-
+#ifndef _FilterKernels_h_
+#define _FilterKernels_h_
+
+#include "cs1300bmp.h"
+#include "Filter.h"
+
+//
+// The implementations of the 3x3 convolution. Scalar is the reference;
+// the others must give exactly the same bytes.
+//
+enum KernelPath {
+  KERNEL_SCALAR,
+  KERNEL_SSE41,
+  KERNEL_AVX2,
+  KERNEL_AVX512,
+  KERNEL_PATHS
+};
+
+const char *kernelPathName(KernelPath path);
+//
+// Returns the path with the given name, or KERNEL_PATHS if there is none
+//
+KernelPath kernelPathNamed(const char *name);
+//
+// The widest path this CPU can run
+//
+KernelPath kernelPathDetect();
+
+//
+// A 3x3 filter in the form the kernels use: coefficients in row-major
+// order and the divisor
+//
+struct Kernel3x3 {
+  int coef[9];
+  int divisor;
+  //
+  // When multiplier is nonzero, every |sum| fits in 16 bits and the
+  // vector paths divide it with a 16-bit multiply high and a right
+  // shift by shift; otherwise they divide in single precision
+  //
+  int multiplier;
+  int shift;
+  //
+  // Every coefficient fits in a signed byte, every partial sum in 16
+  // bits, and any division has a multiplier, so the vector paths can
+  // multiply the bytes directly (pmaddubsw) and keep the sums in 16-bit
+  // lanes, twice as many pixels a vector as 32-bit sums
+  //
+  bool narrow;
+};
+
+//
+// Loads FILTER, whose analyze() must have run, choosing 16-bit sums
+// when its range allows them
+//
+void kernelLoad3x3(Filter *filter, Kernel3x3 *kernel);
+
+//
+// Whether kernelLoad3x3 may choose 16-bit sums; on unless turned off,
+// e.g. to compare the two
+//
+void kernelAllowNarrow(bool allow);
+
+//
+// Filters one row of a plane: out[1 .. width-2] from the three input
+// rows around it. out[0] and out[width-1] are set to 0.
+//
+typedef void (*RowFilter3x3)(const cs1300pixel *above, const cs1300pixel *middle,
+			     const cs1300pixel *below, cs1300pixel *out,
+			     int width, const Kernel3x3 *kernel);
+
+//
+// The row filter for PATH, or for the widest narrower path that can run
+// KERNEL exactly
+//
+RowFilter3x3 rowFilter3x3(KernelPath path, const Kernel3x3 *kernel);
+
+//
+// The same for interleaved BGR rows, WIDTH pixels of three samples
+// each: every color of out[3 .. 3*width-4] is filtered from the same
+// color of the input rows, and the first and last pixels are set to 0.
+// Only the samples of the pixels are read and written. NULL when
+// pixels are wider than the bytes of a file.
+//
+RowFilter3x3 rowFilter3x3Interleaved(KernelPath path, const Kernel3x3 *kernel);
+
+//
+// Most filters one bank runs at once
+//
+#define KERNEL_BANK_MAX 8
+
+//
+// Filters one row with COUNT 3x3 filters at once, kernels[k] into
+// out[k]. The vector paths load each neighborhood once for all of them.
+//
+typedef void (*BankFilter3x3)(const cs1300pixel *above, const cs1300pixel *middle,
+			      const cs1300pixel *below, cs1300pixel *const *out,
+			      int width, const Kernel3x3 *kernels, int count);
+
+//
+// The bank filter for PATH, or for scalar if any of the KERNELS cannot
+// run exactly on the vector paths
+//
+BankFilter3x3 bankFilter3x3(KernelPath path, const Kernel3x3 *kernels, int count);
+
+//
+// Largest filter the N x N kernels take
+//
+#define KERNEL_MAX_SIZE 31
+
+//
+// How a planned filter turns a sum into a pixel
+//
+enum KernelFinish {
+  //
+  // The sum is always 0..255 already
+  //
+  FINISH_NONE,
+  //
+  // Clamp to 0..255
+  //
+  FINISH_CLAMP,
+  //
+  // Divide by a power of two with a shift
+  //
+  FINISH_SHIFT,
+  //
+  // Divide |sum| by multiplying and shifting, then put the sign back
+  //
+  FINISH_RECIPROCAL,
+  //
+  // Divide in single precision; only chosen by the vector paths
+  //
+  FINISH_FLOAT,
+  //
+  // Divide with /
+  //
+  FINISH_DIVIDE
+};
+
+//
+// An odd N x N filter (N = size) in row-major order. Its center is at
+// size / 2, and that many pixels around the edge of the output are 0.
+//
+struct KernelNxN {
+  int size;
+  int coef[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+  int divisor;
+  //
+  // The plan kernelLoadNxN makes: the nonzero taps, each with its row
+  // and column in the filter
+  //
+  int taps;
+  int tapRow[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+  int tapCol[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+  int tapCoef[KERNEL_MAX_SIZE * KERNEL_MAX_SIZE];
+  //
+  // The cheapest exact way to finish a pixel, with its shift and
+  // multiplier
+  //
+  KernelFinish finish;
+  int shift;
+  unsigned long long multiplier;
+  //
+  // No sum is too big to divide exactly in single precision
+  //
+  bool floatExact;
+  //
+  // The filter leaves pixels unchanged
+  //
+  bool identity;
+};
+
+//
+// Loads FILTER and plans how to run it
+//
+void kernelLoadNxN(Filter *filter, KernelNxN *kernel);
+
+//
+// Filters one row of a plane from the size input rows centered on it;
+// rows[i] is input row (row - size/2 + i). The first and last size/2
+// output pixels are set to 0.
+//
+typedef void (*RowFilterNxN)(const cs1300pixel *const *rows, cs1300pixel *out,
+			     int width, const KernelNxN *kernel);
+
+//
+// The row filter for PATH. Sizes 3, 5 and 7 have their own fully
+// unrolled kernels; other sizes, and filters with zero taps on the
+// scalar path, take a loop over the nonzero taps. Identity filters copy.
+//
+RowFilterNxN rowFilterNxN(KernelPath path, const KernelNxN *kernel);
+
+//
+// Scalar N x N row filter over interleaved BGR rows; rows[i] points at
+// the first sample of the wanted color
+//
+void filterRowNxNInterleaved(const unsigned char *const *rows, cs1300pixel *out,
+			     int width, const KernelNxN *kernel);
+
+//
+// One filter, ready to be run a row at a time: with the hand-vectorized
+// 3x3 kernel when one can run it, else filterRow is NULL and the planned
+// N x N kernel runs it
+//
+struct FilterStage {
+  //
+  // Half the filter size
+  //
+  int radius;
+  Kernel3x3 kernel;
+  RowFilter3x3 filterRow;
+  KernelNxN kernelN;
+  RowFilterNxN filterRowN;
+};
+
+void filterStageLoad(KernelPath path, Filter *filter, FilterStage *stage);
+
+//
+// Filters one row of a plane; rows[i] is input row (row - radius + i)
+//
+void filterStageRow(const FilterStage *stage, const cs1300pixel *const *rows,
+		    cs1300pixel *out, int width);
+
+//
+// A separable N x N filter, coef[i * size + j] == col[i] * row[j], run in
+// two passes: a horizontal pass per input row into a narrow
+// intermediate, then a vertical pass over size of those rows. That is
+// 2 * size multiplies a pixel instead of size * size, with the same
+// result as the 2D filter.
+//
+struct KernelSeparable {
+  int size;
+  int row[KERNEL_MAX_SIZE];
+  int col[KERNEL_MAX_SIZE];
+  //
+  // The horizontal sums fit in 16 bits
+  //
+  bool narrow;
+  //
+  // Instruction set the passes are compiled for
+  //
+  KernelPath path;
+  //
+  // How a sum becomes a pixel, as the N x N plan does it
+  //
+  KernelFinish finish;
+  int divisor;
+  int shift;
+  unsigned long long multiplier;
+};
+
+//
+// Fills in KERNEL and returns true if FILTER is separable and the
+// two-pass engine can run it exactly on PATH; filter -> analyze() must
+// have run, and PLAN must have been loaded from FILTER
+//
+bool kernelLoadSeparable(KernelPath path, Filter *filter, const KernelNxN *plan,
+			 KernelSeparable *kernel);
+
+//
+// Bytes of scratch filterBandSeparable needs for a filter of SIZE and
+// rows WIDTH pixels wide
+//
+size_t separableScratchSize(int size, int width);
+
+//
+// Filters rows FIRST .. LAST-1 of one plane, with the same borders as
+// the N x N row filters. Input rows FIRST-size/2 through LAST-1+size/2
+// must exist.
+//
+void filterBandSeparable(cs1300image *input, cs1300image *output, int plane,
+			 int first, int last, const KernelSeparable *kernel, void *scratch);
+
+//
+// A box filter, one whose coefficients are all the same, runs in the
+// same time per pixel whatever its size: each band keeps the sums of
+// the size rows around the current one for every column, and slides a
+// window along them. Returns true if FILTER is a box; KERNEL must have
+// been loaded from it.
+//
+bool kernelIsBox(Filter *filter, const KernelNxN *kernel);
+
+//
+// Bytes of scratch the box band filters need for rows WIDTH pixels wide
+//
+size_t boxScratchSize(int width);
+
+//
+// Filters rows FIRST .. LAST-1 of one plane with the box engine, into
+// row FIRST .. LAST-1 of OUTPUT, with the same borders as the N x N row
+// filters. INPUT is the start of row 0 of the plane and STRIDE the
+// distance between rows, in samples; rows FIRST-size/2 through
+// LAST-1+size/2 must exist. The interleaved version takes a plane of a
+// cs1300view, with STRIDE in bytes.
+//
+void filterBandBox(KernelPath path, const cs1300pixel *input, long stride,
+		   cs1300image *output, int plane, int first, int last,
+		   const KernelNxN *kernel, void *scratch);
+void filterBandBoxInterleaved(const unsigned char *input, long stride,
+			      cs1300image *output, int plane, int first, int last,
+			      const KernelNxN *kernel, void *scratch);
+
+#endif
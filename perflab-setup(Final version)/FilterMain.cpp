@@ -3,7 +3,27 @@
 #include <iostream>
 #include <fstream>
 #include "Filter.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
+#include "FilterGraph.h"
+#include "FilterApply.h"
+#include "ImageCache.h"
+#include "ResultStore.h"
+#include "BoundedQueue.h"
+#include "FilterStream.h"
+#include "PerfCounters.h"
+#include "FilterTrace.h"
+#include "Roofline.h"
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -12,174 +32,1038 @@ using namespace std;
 //
 // Forward declare the functions
 //
-Filter * readFilter(string filename);
-double applyFilter(Filter *filter, cs1300bmp *input, cs1300bmp *output);
+static string outputName(string filtername);
+struct Batch;
+static void runSequential(Batch *batch, vector<string> &inputs);
+static void runPipeline(Batch *batch, vector<string> &inputs, int slots);
+static void runThroughput(Batch *batch, vector<string> &inputs);
+static void runStreaming(Batch *batch, vector<string> &inputs);
+static void runRoofline(Batch *batch, vector<string> &inputs);
+static void reportBatch(Batch *batch, const char *mode, double seconds);
+static void reportStages(Batch *batch, const char *mode, double seconds, long long ticks, const char *jsonFile);
+static void reportCounters(Batch *batch);
+
+//
+// How input images are loaded
+//
+enum LoadMode {
+  //
+  // Decode into a cs1300image
+  //
+  LOAD_READ,
+  //
+  // Map the file and filter straight from the mapped pixels
+  //
+  LOAD_MMAP
+};
+
+//
+// Everything main does to each input, set up once from the command line
+//
+struct Batch {
+  LoadMode loadMode;
+  //
+  // Whether images stay interleaved, as in the files, from reading to
+  // writing instead of being split into planes
+  //
+  bool interleaved;
+  ImageCache *cache;
+  ResultStore *store;
+  //
+  // The --graph chain, or else the filters, each with the name of its
+  // outputs and what they depend on besides the input
+  //
+  FilterGraph *graph;
+  vector<Filter *> filters;
+  vector<string> filterOutputNames;
+  vector<unsigned long long> filterHashes;
+  int count;
+  //
+  // Cycles per pixel of every input filtered, and how many there were;
+  // with the cycles each input took from being read to being written,
+  // all under lock
+  //
+  mutex lock;
+  double sum;
+  int samples;
+  vector<long long> imageCycles;
+  //
+  // With a result store, the output files some slot has claimed, from
+  // before it fetches them until it has stored them, under lock. A slot
+  // waits until its outputs are free before fetching, so a fetch never
+  // relinks an output that is still being written or stored.
+  //
+  set<string> claimed;
+  condition_variable released;
+  //
+  // What decoding, filtering and encoding took, and with --counters what
+  // else they counted; the ticks of each spent converting between file
+  // lines and planes; the bytes each read and wrote, and the pixels of
+  // the inputs decoded
+  //
+  CounterSample stageCounts[3];
+  long long stageConverted[3];
+  double stageBytes[3];
+  double countedPixels;
+};
+
+//
+// The stages of Batch::stageCounts
+//
+enum Stage { STAGE_DECODE, STAGE_FILTER, STAGE_ENCODE };
+
+//
+// Where a stage started, for countStage
+//
+struct StageStart {
+  CounterSample counts;
+  long long converted;
+};
+
+//
+// How the time of each stage is reported at the end of the run
+//
+enum StatsFormat { STATS_NONE, STATS_TEXT, STATS_JSON };
+
+//
+// Inputs the pipeline works on at once: one being read, one being
+// filtered and one being written
+//
+static const int pipelineSlots = 3;
 
 int
 main(int argc, char **argv)
 {
+  LoadMode loadMode = LOAD_READ;
+  int threads = ThreadPool::cpus();
+  //
+  // Megabytes of decoded images kept for inputs that are read again
+  //
+  long cacheMB = 256;
+  //
+  // Directory of stored outputs, if any, and megabytes it may hold
+  //
+  string memoDirectory;
+  long memoMB = 1024;
+  bool usePipeline = true;
+  //
+  // Whether the threads share each image or each take whole images
+  //
+  bool throughput = false;
+  //
+  // Whether each input is filtered line by line from disk to disk
+  //
+  bool streaming = false;
+  bool interleaved = false;
+  StatsFormat stats = STATS_TEXT;
+  string statsFilename = "stats.json";
+  //
+  // Whether to measure the memory and compare the filters against it
+  // instead of writing outputs
+  //
+  bool roofline = false;
+  vector<string> args;
+  //
+  // The stages of --graph; when there are any, every other argument is
+  // an input file
+  //
+  vector<string> stageNames;
 
-  if ( argc < 2) {
-    fprintf(stderr,"Usage: %s filter inputfile1 inputfile2 .... \n", argv[0]);
-  }
+  kernelPath = kernelPathDetect();
 
   //
-  // Convert to C++ strings to simplify manipulation
+  // Options start with "--" and may appear anywhere; everything else is
+  // the filters followed by the input files
   //
-  string filtername = argv[1];
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if ( arg == "--load=read" ) {
+      loadMode = LOAD_READ;
+    } else if ( arg == "--load=mmap" ) {
+      loadMode = LOAD_MMAP;
+    } else if ( arg.compare(0, 9, "--kernel=") == 0 ) {
+      //
+      // Ask for a narrower path than the CPU has, e.g. to compare them
+      //
+      KernelPath want = kernelPathNamed(arg.c_str() + 9);
+      if ( want == KERNEL_PATHS ) {
+	fprintf(stderr, "Unknown kernel %s\n", arg.c_str() + 9);
+	exit(-1);
+      }
+      if ( want > kernelPathDetect() ) {
+	fprintf(stderr, "This CPU cannot run the %s kernel\n", kernelPathName(want));
+	exit(-1);
+      }
+      kernelPath = want;
+    } else if ( arg.compare(0, 10, "--threads=") == 0 ) {
+      threads = atoi(arg.c_str() + 10);
+      if ( threads < 1 ) {
+	fprintf(stderr, "Bad thread count %s\n", arg.c_str() + 10);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 8, "--cache=") == 0 ) {
+      char *end;
+      cacheMB = strtol(arg.c_str() + 8, &end, 10);
+      if ( cacheMB < 0 || *end != 0 || end == arg.c_str() + 8 ) {
+	fprintf(stderr, "Bad cache size %s\n", arg.c_str() + 8);
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 7, "--memo=") == 0 ) {
+      memoDirectory = arg.substr(7);
+    } else if ( arg.compare(0, 13, "--memo-limit=") == 0 ) {
+      char *end;
+      memoMB = strtol(arg.c_str() + 13, &end, 10);
+      if ( memoMB < 0 || *end != 0 || end == arg.c_str() + 13 ) {
+	fprintf(stderr, "Bad store size %s\n", arg.c_str() + 13);
+	exit(-1);
+      }
+    } else if ( arg == "--mode=latency" ) {
+      throughput = false;
+    } else if ( arg == "--mode=throughput" ) {
+      throughput = true;
+    } else if ( arg == "--stream" ) {
+      streaming = true;
+    } else if ( arg == "--layout=planar" ) {
+      interleaved = false;
+    } else if ( arg == "--layout=interleaved" ) {
+      interleaved = true;
+    } else if ( arg == "--no-pipeline" ) {
+      usePipeline = false;
+    } else if ( arg.compare(0, 7, "--tile=") == 0 ) {
+      char *end;
+      tileOption = strtol(arg.c_str() + 7, &end, 10);
+      if ( tileOption < 0 || *end != 0 || end == arg.c_str() + 7 ) {
+	fprintf(stderr, "Bad tile size %s\n", arg.c_str() + 7);
+	exit(-1);
+      }
+    } else if ( arg == "--no-separable" ) {
+      useSeparable = false;
+    } else if ( arg == "--no-box" ) {
+      useBox = false;
+    } else if ( arg.compare(0, 8, "--stats=") == 0 ) {
+      //
+      // The stage times as a table on stderr, or as one line of JSON in
+      // a file of its own, stats.json unless named, so nothing else is
+      // mixed in with it
+      //
+      string format = arg.substr(8);
+      if ( format == "text" ) {
+	stats = STATS_TEXT;
+      } else if ( format == "json" ) {
+	stats = STATS_JSON;
+      } else if ( format.compare(0, 5, "json:") == 0 && format.size() > 5 ) {
+	stats = STATS_JSON;
+	statsFilename = format.substr(5);
+      } else if ( format == "none" ) {
+	stats = STATS_NONE;
+      } else {
+	fprintf(stderr, "Bad stats format %s\n", format.c_str());
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 8, "--trace=") == 0 ) {
+      //
+      // Record when each stage, band and tile ran on each thread, and
+      // write the timeline to the file at the end
+      //
+      if ( ! traceStart(arg.c_str() + 8) ) {
+	fprintf(stderr, "This filter was built without tracing (FILTER_TRACE=0)\n");
+	exit(-1);
+      }
+      traceThreadName("main");
+    } else if ( arg == "--roofline" ) {
+      roofline = true;
+    } else if ( arg == "--counters" ) {
+      //
+      // Count cycles, instructions and misses of each stage
+      //
+      countersEnable();
+    } else if ( arg == "--no-narrow" ) {
+      //
+      // Keep 3x3 sums in 32-bit lanes even when 16 would do
+      //
+      kernelAllowNarrow(false);
+    } else if ( arg.compare(0, 8, "--graph=") == 0 ) {
+      //
+      // A chain of filters, separated by commas, run in one pass
+      //
+      string list = arg.substr(8);
+      string::size_type start = 0;
+      while ( start <= list.size() ) {
+	string::size_type comma = list.find(',', start);
+	if ( comma == string::npos ) {
+	  comma = list.size();
+	}
+	if ( comma > start ) {
+	  stageNames.push_back(list.substr(start, comma - start));
+	}
+	start = comma + 1;
+      }
+      if ( stageNames.empty() ) {
+	fprintf(stderr, "No filters in %s\n", arg.c_str());
+	exit(-1);
+      }
+    } else if ( arg.compare(0, 2, "--") == 0 ) {
+      fprintf(stderr, "Unknown option %s\n", arg.c_str());
+      exit(-1);
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if ( args.size() < 1 && stageNames.empty() ) {
+    fprintf(stderr,"Usage: %s [--load=read|mmap] [--kernel=scalar|sse4|avx2|avx512] [--threads=N] [--cache=MB] [--memo=DIR] [--memo-limit=MB] [--mode=latency|throughput] [--stream] [--layout=planar|interleaved] [--tile=ROWS] [--no-pipeline] [--no-separable] [--no-box] [--no-narrow] [--counters] [--stats=text|json[:FILE]|none] [--trace=FILE] [--roofline] filter [filter2.filter ...] inputfile1 inputfile2 .... \n", argv[0]);
+    fprintf(stderr,"       %s [options] --graph=filter1,filter2,... inputfile1 inputfile2 .... \n", argv[0]);
+    exit(-1);
+  }
+  if ( streaming && ! stageNames.empty() ) {
+    fprintf(stderr, "--stream cannot run a --graph chain\n");
+    exit(-1);
+  }
+  if ( roofline && ( streaming || ! stageNames.empty() ) ) {
+    fprintf(stderr, "--roofline cannot run with --stream or --graph\n");
+    exit(-1);
+  }
+  if ( interleaved && ( streaming || ! stageNames.empty() ) ) {
+    fprintf(stderr, "--layout=interleaved cannot run with --stream or --graph\n");
+    exit(-1);
+  }
 
   //
-  // remove any ".filter" in the filtername
+  // Several filters make a bank: each input is read once and every
+  // filter writes its own output from it
   //
-  string filterOutputName = filtername;
-  string::size_type loc = filterOutputName.find(".filter");
-  if (loc != string::npos) {
+  Batch batch;
+  unsigned int firstInput;
+
+  batch.graph = NULL;
+  if ( stageNames.empty() ) {
     //
-    // Remove the ".filter" name, which should occur on all the provided filters
+    // The first argument is always a filter; the ones after it are too,
+    // up to the first that is not a .filter file
     //
-    filterOutputName = filtername.substr(0, loc);
+    firstInput = 0;
+    while ( firstInput < args.size()
+	    && ( firstInput == 0 || args[firstInput].find(".filter") != string::npos ) ) {
+      string filtername = args[firstInput];
+      batch.filterOutputNames.push_back(outputName(filtername));
+      batch.filters.push_back(readFilter(filtername));
+      batch.filterHashes.push_back(ResultStore::hashFilter(batch.filters.back()));
+      firstInput++;
+    }
+  } else {
+    //
+    // A chain is named after its stages, e.g. filtered-gauss+emboss-boats.bmp
+    //
+    vector<Filter *> stages;
+    string filterOutputName;
+    unsigned long long chainHash = 0;
+    for (unsigned int s = 0; s < stageNames.size(); s++) {
+      stages.push_back(readFilter(stageNames[s]));
+      filterOutputName += (s > 0 ? "+" : "") + outputName(stageNames[s]);
+      chainHash = ResultStore::hashChain(chainHash, ResultStore::hashFilter(stages[s]));
+    }
+    batch.graph = new FilterGraph(kernelPath, stages.data(), stages.size());
+    batch.filterOutputNames.push_back(filterOutputName);
+    batch.filterHashes.push_back(chainHash);
+    firstInput = 0;
   }
+  batch.count = batch.filterOutputNames.size();
+  batch.loadMode = loadMode;
+  batch.interleaved = interleaved;
+  batch.cache = cacheMB > 0 ? new ImageCache((size_t) cacheMB << 20) : NULL;
+  batch.store = memoDirectory.empty() ? NULL
+    : new ResultStore(memoDirectory, (unsigned long long) memoMB << 20);
+  batch.sum = 0.0;
+  batch.samples = 0;
+  memset(batch.stageCounts, 0, sizeof(batch.stageCounts));
+  memset(batch.stageConverted, 0, sizeof(batch.stageConverted));
+  memset(batch.stageBytes, 0, sizeof(batch.stageBytes));
+  batch.countedPixels = 0;
+  pool = new ThreadPool(threads);
 
-  Filter *filter = readFilter(filtername);
+  vector<string> inputs(args.begin() + firstInput, args.end());
+  if ( roofline ) {
+    runRoofline(&batch, inputs);
+    delete pool;
+    return 0;
+  }
+  chrono::steady_clock::time_point started = chrono::steady_clock::now();
+  long long ticksStart = rdtscll();
+  if ( streaming ) {
+    runStreaming(&batch, inputs);
+  } else if ( throughput ) {
+    runThroughput(&batch, inputs);
+  } else if ( usePipeline && inputs.size() > 1 ) {
+    runPipeline(&batch, inputs, pipelineSlots);
+  } else {
+    runSequential(&batch, inputs);
+  }
+  long long ticks = rdtscll() - ticksStart;
+  chrono::duration<double> seconds = chrono::steady_clock::now() - started;
+  const char *mode = streaming ? "streaming" : throughput ? "throughput" : "latency";
+  reportBatch(&batch, mode, seconds.count());
+  //
+  // --stream reads, filters and writes each line in turn, so it has no
+  // stages to tell apart
+  //
+  if ( stats != STATS_NONE && ! streaming ) {
+    reportStages(&batch, mode, seconds.count(), ticks,
+		 stats == STATS_JSON ? statsFilename.c_str() : NULL);
+  }
+  if ( countersEnabled() ) {
+    reportCounters(&batch);
+  }
+  traceStop();
 
-  double sum = 0.0;
-  int samples = 0;
+  if ( batch.store ) {
+    batch.store -> report();
+  }
+  delete batch.store;
+  if ( batch.cache && batch.cache -> hits() > 0 ) {
+    fprintf(stderr, "Image cache: %lu hits, %lu misses\n", batch.cache -> hits(), batch.cache -> misses());
+  }
+  delete batch.cache;
+  delete batch.graph;
+  delete pool;
+  fprintf(stdout, "Average cycles per sample is %f\n", batch.samples ? batch.sum / batch.samples : 0.0);
 
-  for (int inNum = 2; inNum < argc; inNum++) {
-    string inputFilename = argv[inNum];
-    string outputFilename = "filtered-" + filterOutputName + "-" + inputFilename;
-    struct cs1300bmp *input = new struct cs1300bmp;
-    struct cs1300bmp *output = new struct cs1300bmp;
-    int ok = cs1300bmp_readfile( (char *) inputFilename.c_str(), input);
+}
 
-    if ( ok ) {
-      double sample = applyFilter(filter, input, output);
-      sum += sample;
-      samples++;
-      cs1300bmp_writefile((char *) outputFilename.c_str(), output);
+//
+// One input on its way through the stages, with the buffers it uses.
+// The buffers are sized to each input and reused from one to the next.
+//
+struct Slot {
+  string inputFilename;
+  int ok;
+  //
+  // The input, mapped or decoded; image is decoded, or comes from the
+  // cache. An interleaved input read from the file is in packed, and
+  // view looks at it.
+  //
+  cs1300view view;
+  cs1300image *decoded;
+  cs1300image *image;
+  cs1300packed *packed;
+  vector<cs1300image *> outputs;
+  vector<cs1300packed *> packedOutputs;
+  vector<string> outputFilenames;
+  //
+  // The outputs to filter and write; the others came from the result
+  // store
+  //
+  unsigned long long imageHash;
+  vector<int> runIndex;
+  //
+  // When reading the input began
+  //
+  long long started;
+
+  Slot(int count) : decoded(cs1300image_new(0, 0)), packed(cs1300packed_new(0, 0)),
+		    outputs(count), packedOutputs(count), outputFilenames(count) {
+    for (int k = 0; k < count; k++) {
+      outputs[k] = cs1300image_new(0, 0);
+      packedOutputs[k] = cs1300packed_new(0, 0);
+    }
+  }
+  ~Slot() {
+    cs1300image_delete(decoded);
+    cs1300packed_delete(packed);
+    for (unsigned int k = 0; k < outputs.size(); k++) {
+      cs1300image_delete(outputs[k]);
+      cs1300packed_delete(packedOutputs[k]);
     }
-    delete input;
-    delete output;
   }
-  fprintf(stdout, "Average cycles per sample is %f\n", sum / samples);
+};
+
+//
+// The pixels of the input SLOT holds
+//
+static double
+slotPixels(Batch *batch, Slot *slot)
+{
+  if ( batch -> loadMode == LOAD_MMAP || batch -> interleaved ) {
+    return (double) slot -> view.width * slot -> view.height;
+  }
+  return (double) slot -> image -> width * slot -> image -> height;
+}
 
+static void
+startStage(StageStart *start)
+{
+  countersRead(&start -> counts);
+  start -> converted = cs1300bmp_convertticks();
 }
 
-struct Filter *
-readFilter(string filename)
+//
+// Adds what STAGE took and counted since START, and the BYTES it moved,
+// to the batch
+//
+static void
+countStage(Batch *batch, Stage stage, const StageStart *start, double bytes)
 {
-  ifstream input(filename.c_str());
+  CounterSample stop, diff;
+  countersRead(&stop);
+  countersDiff(&stop, &start -> counts, &diff);
+  long long converted = cs1300bmp_convertticks() - start -> converted;
+  lock_guard<mutex> hold(batch -> lock);
+  countersAdd(&batch -> stageCounts[stage], &diff);
+  batch -> stageConverted[stage] += converted;
+  batch -> stageBytes[stage] += bytes;
+}
 
-  if ( ! input.bad() ) {
-    int size = 0;
-    input >> size;
-    Filter *filter = new Filter(size);
-    int div;
-    input >> div;
-    filter -> setDivisor(div);
-    for (int i=0; i < size; i++) {
-      for (int j=0; j < size; j++) {
-	int value;
-	input >> value;
-	filter -> set(i,j,value);
+//
+// Waits until no other slot holds any output of SLOT, then claims them
+// all. Claiming them together means a slot holds no claims while it
+// waits, so slots cannot wait on each other.
+//
+static void
+claimOutputs(Batch *batch, Slot *slot)
+{
+  unique_lock<mutex> guard(batch -> lock);
+  for (;;) {
+    int k = 0;
+    while ( k < batch -> count && batch -> claimed.count(slot -> outputFilenames[k]) == 0 ) {
+      k++;
+    }
+    if ( k == batch -> count ) {
+      break;
+    }
+    batch -> released.wait(guard);
+  }
+  for (int k = 0; k < batch -> count; k++) {
+    batch -> claimed.insert(slot -> outputFilenames[k]);
+  }
+}
+
+//
+// Lets go of the outputs of SLOT that were FILTERED, or else of those
+// fetched from the store
+//
+static void
+releaseOutputs(Batch *batch, Slot *slot, bool filtered)
+{
+  vector<bool> run(batch -> count, false);
+  for (unsigned int i = 0; i < slot -> runIndex.size(); i++) {
+    run[slot -> runIndex[i]] = true;
+  }
+  {
+    lock_guard<mutex> hold(batch -> lock);
+    for (int k = 0; k < batch -> count; k++) {
+      if ( run[k] == filtered ) {
+	batch -> claimed.erase(slot -> outputFilenames[k]);
       }
     }
-    return filter;
+  }
+  batch -> released.notify_all();
+}
+
+/*
+first stage: loads the input of SLOT, and links in any outputs the
+result store has for it
+*/
+static void
+decodeInput(Batch *batch, Slot *slot)
+{
+  TRACE_SPAN("decode", -1);
+  StageStart start;
+  startStage(&start);
+  slot -> started = start.counts.ticks;
+  slot -> image = slot -> decoded;
+  if ( batch -> loadMode == LOAD_MMAP ) {
+    slot -> ok = cs1300view_open( (char *) slot -> inputFilename.c_str(), &slot -> view);
+  } else if ( batch -> interleaved ) {
+    //
+    // Read as the file has it; the cache only holds planes
+    //
+    slot -> ok = cs1300packed_readfile( (char *) slot -> inputFilename.c_str(), slot -> packed);
+    cs1300packed_view(slot -> packed, &slot -> view);
+  } else if ( batch -> cache ) {
+    //
+    // A file seen before comes from the cache without decoding it again
+    //
+    slot -> image = batch -> cache -> load(slot -> inputFilename.c_str());
+    slot -> ok = slot -> image != NULL;
   } else {
-    cerr << "Bad input in readFilter:" << filename << endl;
-    exit(-1);
+    slot -> ok = cs1300bmp_readfile( (char *) slot -> inputFilename.c_str(), slot -> decoded);
+  }
+  if ( ! slot -> ok ) {
+    return;
+  }
+
+  ResultStore *store = batch -> store;
+  slot -> imageHash = 0;
+  if ( store ) {
+    slot -> imageHash = batch -> loadMode == LOAD_MMAP || batch -> interleaved
+      ? ResultStore::hashImage(&slot -> view) : ResultStore::hashImage(slot -> image);
+  }
+  slot -> runIndex.clear();
+  for (int k = 0; k < batch -> count; k++) {
+    slot -> outputFilenames[k] = "filtered-" + batch -> filterOutputNames[k] + "-" + slot -> inputFilename;
+  }
+  if ( store ) {
+    claimOutputs(batch, slot);
+  }
+  for (int k = 0; k < batch -> count; k++) {
+    if ( ! store || ! store -> fetch(slot -> imageHash, batch -> filterHashes[k], slot -> outputFilenames[k]) ) {
+      slot -> runIndex.push_back(k);
+    }
+  }
+  if ( store ) {
+    releaseOutputs(batch, slot, false);
   }
+  //
+  // Three bytes of each pixel read, and as many written unless mapped
+  //
+  double pixels = slotPixels(batch, slot);
+  countStage(batch, STAGE_DECODE, &start,
+	     batch -> loadMode == LOAD_MMAP ? 3 * pixels : 6 * pixels);
+  lock_guard<mutex> hold(batch -> lock);
+  batch -> countedPixels += pixels;
 }
 
+/*
+second stage: runs the filters the outputs of SLOT still need, on the
+threads of the pool, then lets go of the input
+*/
+static void
+filterInput(Batch *batch, Slot *slot)
+{
+  if ( ! slot -> ok ) {
+    return;
+  }
+  TRACE_SPAN("filter", -1);
+  if ( ! slot -> runIndex.empty() ) {
+    StageStart start;
+    startStage(&start);
+    vector<Filter *> runFilters;
+    vector<cs1300image *> runOutputs;
+    for (unsigned int i = 0; i < slot -> runIndex.size(); i++) {
+      int k = slot -> runIndex[i];
+      runFilters.push_back(batch -> graph ? NULL : batch -> filters[k]);
+      runOutputs.push_back(slot -> outputs[k]);
+    }
+    double sample = 0;
+    if ( batch -> interleaved ) {
+      for (unsigned int i = 0; i < slot -> runIndex.size(); i++) {
+	int k = slot -> runIndex[i];
+	sample += applyFilter(batch -> filters[k], &slot -> view, slot -> packedOutputs[k]);
+      }
+    } else if ( batch -> loadMode == LOAD_MMAP ) {
+      sample = applyFilters(batch -> graph, runFilters.data(), runFilters.size(),
+			    &slot -> view, runOutputs.data());
+    } else {
+      sample = applyFilters(batch -> graph, runFilters.data(), runFilters.size(),
+			    slot -> image, runOutputs.data());
+    }
+    //
+    // The input read, and each output written, once
+    //
+    countStage(batch, STAGE_FILTER, &start,
+	       3 * slotPixels(batch, slot) * (1 + slot -> runIndex.size()));
+    lock_guard<mutex> hold(batch -> lock);
+    batch -> sum += sample;
+    batch -> samples++;
+  }
+  if ( batch -> loadMode == LOAD_MMAP || batch -> interleaved ) {
+    cs1300view_close(&slot -> view);
+  } else if ( batch -> cache ) {
+    batch -> cache -> release(slot -> image);
+  }
+}
 
-double
-applyFilter(struct Filter *filter, cs1300bmp *input, cs1300bmp *output)
+/*
+last stage: writes the outputs of SLOT that were filtered, and keeps
+them in the result store
+*/
+static void
+encodeInput(Batch *batch, Slot *slot)
 {
+  if ( ! slot -> ok ) {
+    return;
+  }
+  TRACE_SPAN("encode", -1);
+  StageStart start;
+  startStage(&start);
+  double bytes = 0;
+  for (unsigned int i = 0; i < slot -> runIndex.size(); i++) {
+    int k = slot -> runIndex[i];
+    string outputFilename = slot -> outputFilenames[k];
+    //
+    // Written as a new file, since the old one may be linked to an
+    // entry of a result store
+    //
+    unlink(outputFilename.c_str());
+    if ( batch -> interleaved ) {
+      cs1300packed_writefile((char *) outputFilename.c_str(), slot -> packedOutputs[k]);
+      bytes += 6.0 * slot -> packedOutputs[k] -> width * slot -> packedOutputs[k] -> height;
+    } else {
+      cs1300bmp_writefile((char *) outputFilename.c_str(), slot -> outputs[k]);
+      bytes += 6.0 * slot -> outputs[k] -> width * slot -> outputs[k] -> height;
+    }
+    if ( batch -> store ) {
+      batch -> store -> store(slot -> imageHash, batch -> filterHashes[k], outputFilename);
+    }
+  }
+  countStage(batch, STAGE_ENCODE, &start, bytes);
+  if ( batch -> store ) {
+    releaseOutputs(batch, slot, true);
+  }
+  lock_guard<mutex> hold(batch -> lock);
+  batch -> imageCycles.push_back(rdtscll() - slot -> started);
+}
 
-  long long cycStart, cycStop;
+static void
+runSequential(Batch *batch, vector<string> &inputs)
+{
+  Slot slot(batch -> count);
+  for (unsigned int i = 0; i < inputs.size(); i++) {
+    slot.inputFilename = inputs[i];
+    decodeInput(batch, &slot);
+    filterInput(batch, &slot);
+    encodeInput(batch, &slot);
+  }
+}
 
-  cycStart = rdtscll();
+/*
+the three stages on their own threads, so reading the next input and
+writing the last overlap with filtering this one. Slots go round from
+the reader to the filter to the writer and back; with SLOTS of them,
+the reader can be at most SLOTS inputs ahead of the writer. Filtering
+stays on this thread, which runs the pool.
+*/
+static void
+runPipeline(Batch *batch, vector<string> &inputs, int slots)
+{
+  vector<Slot *> storage;
+  BoundedQueue<Slot *> empty(slots);
+  BoundedQueue<Slot *> decoded(slots + 1);
+  BoundedQueue<Slot *> filtered(slots + 1);
 
-  output -> width = input -> width;
-  output -> height = input -> height;
+  for (int i = 0; i < slots; i++) {
+    storage.push_back(new Slot(batch -> count));
+    empty.push(storage.back());
+  }
 
-  int Width = input -> width - 1;
-  int Height = input -> height - 1;
-  int filterdivisor = filter -> getDivisor();
-  int output0, output1, output2;
-  /*
-  made local variables out of function calls and kept them out the loop
-  so that the computations would be done less frequently
-  */
+  //
+  // A NULL slot marks the end of the inputs
+  //
+  thread reader([&] {
+    traceThreadName("reader");
+    for (unsigned int i = 0; i < inputs.size(); i++) {
+      Slot *slot = empty.pop();
+      slot -> inputFilename = inputs[i];
+      decodeInput(batch, slot);
+      decoded.push(slot);
+    }
+    decoded.push(NULL);
+  });
+  thread writer([&] {
+    traceThreadName("writer");
+    Slot *slot;
+    while ( (slot = filtered.pop()) != NULL ) {
+      encodeInput(batch, slot);
+      empty.push(slot);
+    }
+  });
 
-  int filterMatrix[9] = {
-      filter -> get(0,0), filter -> get(0,1), filter -> get(0,2),
-      filter -> get(1,0), filter -> get(1,1), filter -> get(1,2),
-      filter -> get(2,0), filter -> get(2,1), filter -> get(2,2),
-  };
+  Slot *slot;
+  while ( (slot = decoded.pop()) != NULL ) {
+    filterInput(batch, slot);
+    filtered.push(slot);
+  }
+  filtered.push(NULL);
 
-  /*
-  I made local array of filter->get, so that less time would be spent going into memory to retrieve values
-  */
+  reader.join();
+  writer.join();
+  for (int i = 0; i < slots; i++) {
+    delete storage[i];
+  }
+}
 
-  int row, col, plane;
+//
+// One call of runThroughput: each worker of the pool has its own slot
+// and its own pool of one thread to filter with
+//
+struct ThroughputJob {
+  Batch *batch;
+  vector<string> *inputs;
+  vector<Slot *> slots;
+  vector<ThreadPool *> pools;
+};
 
-/*
-    reordered loops so that they would have better spatial locality
-    In the nested For loop, if the loop with more iteration is put inside, and the loop with less iteration is put outside,
-    its performance will be improved; Reducing the instantiation of loop variables also improves their performance.
+//
+// Makes a pool the calling thread's while it is in scope, then gives the
+// thread back the pool it had, so no thread is left holding a pool that
+// is deleted later
+//
+struct UsePool {
+  ThreadPool *saved;
+  UsePool(ThreadPool *use) : saved(pool) {
+    pool = use;
+  }
+  ~UsePool() {
+    pool = saved;
+  }
+};
 
-    the nested loop read the elements of the array in row-major-order
+static void
+processFile(int index, void *arg)
+{
+  ThroughputJob *job = (ThroughputJob *) arg;
+  int worker = ThreadPool::worker();
+  Slot *slot = job -> slots[worker];
+
+  UsePool own(job -> pools[worker]);
+  slot -> inputFilename = (*job -> inputs)[index];
+  decodeInput(job -> batch, slot);
+  filterInput(job -> batch, slot);
+  encodeInput(job -> batch, slot);
+}
 
+/*
+each thread of the pool takes whole inputs, one after another, and
+reads, filters and writes each one alone. For many small images this
+avoids splitting and joining every image across the threads.
 */
-for( plane = 0; plane < 3; plane++){
-  for( row = 1; row < Height ; row++){
-      for( col = 1; col < Width; col++){
+static void
+runThroughput(Batch *batch, vector<string> &inputs)
+{
+  ThroughputJob job;
+  ThreadPool *shared = pool;
 
+  job.batch = batch;
+  job.inputs = &inputs;
+  for (int worker = 0; worker < shared -> size(); worker++) {
+    job.slots.push_back(new Slot(batch -> count));
+    job.pools.push_back(new ThreadPool(1));
+  }
 
-        int* FILTER_V = &filterMatrix[0];
+  shared -> run(inputs.size(), processFile, &job);
 
-        /*urolled two loops so that there would be less overhead over iterations*/
-        output0 = (input -> color[plane][row-1][col-1] * *(FILTER_V++));
-        output1 = (input -> color[plane][row-1][col] * *(FILTER_V++));
-        output2 = (input -> color[plane][row-1][col+1] * *(FILTER_V++));
+  for (int worker = 0; worker < shared -> size(); worker++) {
+    delete job.slots[worker];
+    delete job.pools[worker];
+  }
+}
 
-        output0 += (input -> color[plane][row][col-1] * *(FILTER_V++));
-        output1 += (input -> color[plane][row][col] * *(FILTER_V++));
-        output2 += (input -> color[plane][row][col+1] * *(FILTER_V++));
+/*
+filters each input as it is read, a line at a time, and writes each
+output line as soon as it is done. No image is ever held, so the cache,
+the result store and the threads are not used.
+*/
+static void
+runStreaming(Batch *batch, vector<string> &inputs)
+{
+  vector<FilterStage> stages(batch -> count);
+  for (int k = 0; k < batch -> count; k++) {
+    filterStageLoad(kernelPath, batch -> filters[k], &stages[k]);
+  }
 
-        output0 += (input -> color[plane][row+1][col-1] * *(FILTER_V++));
-		output1 += (input -> color[plane][row+1][col] * *(FILTER_V++));
-		output2 += (input -> color[plane][row+1][col+1] * *(FILTER_V++));
+  for (unsigned int i = 0; i < inputs.size(); i++) {
+    vector<string> names(batch -> count);
+    vector<const char *> outputFiles(batch -> count);
+    for (int k = 0; k < batch -> count; k++) {
+      names[k] = "filtered-" + batch -> filterOutputNames[k] + "-" + inputs[i];
+      unlink(names[k].c_str());
+      outputFiles[k] = names[k].c_str();
+    }
 
-		output -> color[plane][row][col] = output0 + output1 + output2;
+    long long cycStart = rdtscll();
+    long long pixels = filterStream(inputs[i].c_str(), stages.data(), batch -> count, outputFiles.data());
+    long long cycStop = rdtscll();
+    if ( pixels > 0 ) {
+      batch -> sum += reportCycles(cycStart, cycStop, (double) pixels);
+      batch -> samples++;
+      batch -> imageCycles.push_back(cycStop - cycStart);
+    }
+  }
+}
 
-		/*used three accumulators to hold data and then combined them at the end
-		so computations can be done in parallel and there would be less dependency*/
+//
+// Sweeps the probe and each filter make; the fastest counts
+//
+static const int rooflineTrials = 5;
 
+/*
+--roofline: the read and copy bandwidth of the memory, then each filter
+on each input against them. An image moves at least three samples of
+every pixel in and three out; what it achieves, and how many operations
+it does per byte, places it on the roofline. A filter near the copy
+bandwidth is at the memory wall, and faster kernels cannot help it much.
+Nothing is written.
+*/
+static void
+runRoofline(Batch *batch, vector<string> &inputs)
+{
+  Bandwidth memory = measureBandwidth(pool, rooflineTrials);
+  fprintf(stdout, "Memory: read %.2f GB/s, copy %.2f GB/s (fastest of %d sweeps of %zu MB arrays on %d threads)\n",
+	  memory.read / 1e9, memory.copy / 1e9, memory.trials, memory.arrayBytes >> 20, pool -> size());
 
-		/*made a condition for divisor so division will not be done or done less frequently if the divisor is 1*/
-        if ( filterdivisor > 1){
-        output -> color[plane][row][col] /= filterdivisor;
-        }
+  reportFilters = false;
+  cs1300image *image = cs1300image_new(0, 0);
+  cs1300image *output = cs1300image_new(0, 0);
+  cs1300packed *packed = cs1300packed_new(0, 0);
+  cs1300packed *packedOutput = cs1300packed_new(0, 0);
+  cs1300view view;
 
-        else if ( output -> color[plane][row][col]  < 0 ){
-            output -> color[plane][row][col] = 0;
-            }
+  for (unsigned int i = 0; i < inputs.size(); i++) {
+    char *filename = (char *) inputs[i].c_str();
+    bool ok;
+    if ( batch -> interleaved ) {
+      ok = cs1300packed_readfile(filename, packed);
+      cs1300packed_view(packed, &view);
+    } else {
+      ok = cs1300bmp_readfile(filename, image);
+    }
+    if ( ! ok ) {
+      continue;
+    }
+    //
+    // Three samples of each pixel in and three out: bytes when
+    // interleaved, cs1300pixels when in planes
+    //
+    double pixels = batch -> interleaved ? (double) view.width * view.height
+      : (double) image -> width * image -> height;
+    double bytes = 6 * pixels * (batch -> interleaved ? 1 : sizeof(cs1300pixel));
 
-        else if ( output -> color[plane][row][col]  > 255 ){
-            output -> color[plane][row][col] = 255;
-            }
+    for (int k = 0; k < batch -> count; k++) {
+      Filter *filter = batch -> filters[k];
+      double best = 0;
+      for (int trial = 0; trial < rooflineTrials; trial++) {
+	chrono::steady_clock::time_point started = chrono::steady_clock::now();
+	if ( batch -> interleaved ) {
+	  applyFilter(filter, &view, packedOutput);
+	} else {
+	  applyFilter(filter, image, output);
+	}
+	chrono::duration<double> took = chrono::steady_clock::now() - started;
+	if ( trial == 0 || took.count() < best ) {
+	  best = took.count();
+	}
+      }
+      double achieved = bytes / best;
+      double intensity = filterOperations(filter) * pixels / bytes;
+      double share = achieved / memory.copy;
+      fprintf(stdout, "%s on %s: %.2f GB/s, %.2f Gops/s at %.2f ops per byte; %.1f%% of copy bandwidth, "
+	      "which would allow %.2f Gops/s\n",
+	      batch -> filterOutputNames[k].c_str(), inputs[i].c_str(), achieved / 1e9,
+	      achieved * intensity / 1e9, intensity, 100 * share, memory.copy * intensity / 1e9);
+      if ( bytes <= ThreadPool::cacheSize(3) ) {
+	fprintf(stdout, "  input and output fit in the last-level cache, so memory does not limit this image\n");
+      } else if ( share >= 0.7 ) {
+	fprintf(stdout, "  at the memory wall: faster kernels will not help much\n");
+      } else {
+	fprintf(stdout, "  below the memory wall: faster kernels can still pay off\n");
+      }
+    }
+  }
 
+  cs1300image_delete(image);
+  cs1300image_delete(output);
+  cs1300packed_delete(packed);
+  cs1300packed_delete(packedOutput);
+}
 
-      }
+/*
+images per second over the whole run, and how the cycles from reading
+each input to writing its outputs were spread
+*/
+static void
+reportBatch(Batch *batch, const char *mode, double seconds)
+{
+  vector<long long> &cycles = batch -> imageCycles;
+  int images = cycles.size();
+  if ( images == 0 ) {
+    return;
+  }
+  sort(cycles.begin(), cycles.end());
+  fprintf(stderr, "%s mode: %d images in %f seconds, %f images per second\n",
+	  mode, images, seconds, seconds > 0 ? images / seconds : 0.0);
+  fprintf(stderr, "Cycles per image: min %lld, median %lld, p95 %lld, max %lld\n",
+	  cycles[0], cycles[(images - 1) / 2], cycles[(images * 95 + 99) / 100 - 1], cycles[images - 1]);
+}
+
+/*
+the time of each stage: in all, per image, and as a share of the wall
+time of the run. With the pipeline or --mode=throughput the stages
+overlap, so the shares can add up to more than all of it. Reading and
+writing leave out the time spent converting between the lines of the
+files and planes, which is reported on its own. With JSONFILE the
+same figures go to that file as one JSON object instead.
+*/
+static void
+reportStages(Batch *batch, const char *mode, double seconds, long long ticks, const char *jsonFile)
+{
+  int images = batch -> imageCycles.size();
+  if ( images == 0 || ticks <= 0 ) {
+    return;
+  }
+  static const char *names[] = { "read", "convert", "filter", "write" };
+  CounterSample *counts = batch -> stageCounts;
+  long long *converted = batch -> stageConverted;
+  long long stageTicks[] = {
+    counts[STAGE_DECODE].ticks - converted[STAGE_DECODE],
+    converted[STAGE_DECODE] + converted[STAGE_FILTER] + converted[STAGE_ENCODE],
+    counts[STAGE_FILTER].ticks - converted[STAGE_FILTER],
+    counts[STAGE_ENCODE].ticks - converted[STAGE_ENCODE]
+  };
+  double msPerTick = 1000.0 * seconds / ticks;
+
+  if ( jsonFile ) {
+    FILE *file = fopen(jsonFile, "w");
+    if ( file == NULL ) {
+      fprintf(stderr, "Could not write %s\n", jsonFile);
+      return;
     }
+    fprintf(file, "{\"mode\": \"%s\", \"images\": %d, \"seconds\": %f, \"stages\": [", mode, images, seconds);
+    for (int s = 0; s < 4; s++) {
+      fprintf(file, "%s{\"stage\": \"%s\", \"total_ms\": %f, \"per_image_ms\": %f, \"share\": %f}",
+	      s > 0 ? ", " : "", names[s], stageTicks[s] * msPerTick, stageTicks[s] * msPerTick / images,
+	      (double) stageTicks[s] / ticks);
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return;
+  }
+  fprintf(stderr, "Stage      total ms   ms per image   share of wall time\n");
+  for (int s = 0; s < 4; s++) {
+    fprintf(stderr, "%-8s %10.3f %14.3f %19.1f%%\n", names[s], stageTicks[s] * msPerTick,
+	    stageTicks[s] * msPerTick / images, 100.0 * stageTicks[s] / ticks);
   }
+}
 
-  cycStop = rdtscll();
-  double diff = cycStop - cycStart;
-  double diffPerPixel = diff / (output -> width * output -> height);
-  fprintf(stderr, "Took %f cycles to process, or %f cycles per pixel\n",
-	  diff, diff / (output -> width * output -> height));
-  return diffPerPixel;
+/*
+with --counters, one line per stage; every figure is per input pixel,
+so the stages add up. --stream reads, filters and writes in one loop
+and is not counted.
+*/
+static void
+reportCounters(Batch *batch)
+{
+  static const char *names[] = { "decode", "filter", "encode" };
+  for (int stage = STAGE_DECODE; stage <= STAGE_ENCODE; stage++) {
+    countersReport(names[stage], &batch -> stageCounts[stage], batch -> countedPixels,
+		   batch -> stageBytes[stage]);
+  }
+}
+
+//
+// The name a filter file gives its output files
+//
+static string
+outputName(string filtername)
+{
+  //
+  // remove any ".filter" in the filtername
+  //
+  string filterOutputName = filtername;
+  string::size_type loc = filterOutputName.find(".filter");
+  if (loc != string::npos) {
+    //
+    // Remove the ".filter" name, which should occur on all the provided filters
+    //
+    filterOutputName = filtername.substr(0, loc);
+  }
+  return filterOutputName;
 }
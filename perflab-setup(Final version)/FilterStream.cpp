@@ -0,0 +1,96 @@
+#include "FilterStream.h"
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+long long
+filterStream(const char *inputFile, const FilterStage *stages, int count,
+	     const char *const *outputFiles)
+{
+  struct cs1300stream input;
+  if ( ! cs1300stream_openread((char *) inputFile, &input) ) {
+    return 0;
+  }
+  int width = input.width;
+  int height = input.height;
+
+  vector<struct cs1300stream> outputs(count);
+  int opened = 0;
+  bool ok = true;
+  for ( ; opened < count && ok; opened++) {
+    ok = cs1300stream_openwrite((char *) outputFiles[opened], width, height, &outputs[opened]);
+  }
+  if ( ! ok ) {
+    opened--;
+  }
+
+  //
+  // Input row r lives in row r % depth of the ring, in every plane; the
+  // ring is a cs1300image so its rows have the alignment and slack the
+  // row filters expect. out holds one filtered row per plane.
+  //
+  int reach = 0;
+  for (int k = 0; k < count; k++) {
+    reach = max(reach, stages[k].radius);
+  }
+  int depth = 2 * reach + 1;
+  cs1300image *ring = cs1300image_new(width, depth);
+  cs1300image *out = cs1300image_new(width, 1);
+  cs1300pixel *planes[MAX_COLORS];
+  const cs1300pixel *outPlanes[MAX_COLORS];
+  const cs1300pixel *rows[KERNEL_MAX_SIZE];
+  for (int plane = 0; plane < MAX_COLORS; plane++) {
+    outPlanes[plane] = cs1300image_row(out, plane, 0);
+  }
+
+  //
+  // Once input row r is in, output row r - reach has all it needs; the
+  // last reach rows follow after the input runs out
+  //
+  for (int row = 0; ok && row < height + reach; row++) {
+    if ( row < height ) {
+      for (int plane = 0; plane < MAX_COLORS; plane++) {
+	planes[plane] = cs1300image_row(ring, plane, row % depth);
+      }
+      ok = cs1300stream_readline(&input, planes);
+    }
+    int center = row - reach;
+    if ( ! ok || center < 0 ) {
+      continue;
+    }
+    for (int k = 0; ok && k < count; k++) {
+      int radius = stages[k].radius;
+      for (int plane = 0; plane < MAX_COLORS; plane++) {
+	cs1300pixel *dest = cs1300image_row(out, plane, 0);
+	if ( center < radius || center >= height - radius ) {
+	  memset(dest, 0, width * sizeof(cs1300pixel));
+	} else {
+	  for (int i = 0; i <= 2 * radius; i++) {
+	    rows[i] = cs1300image_row(ring, plane, (center - radius + i) % depth);
+	  }
+	  filterStageRow(&stages[k], rows, dest, width);
+	}
+      }
+      ok = cs1300stream_writeline(&outputs[k], outPlanes);
+    }
+  }
+
+  cs1300stream_close(&input);
+  for (int k = 0; k < opened; k++) {
+    ok = cs1300stream_close(&outputs[k]) && ok;
+  }
+  //
+  // An output cut short still has headers claiming the whole image, so
+  // none is left behind, just as the in-memory path writes nothing
+  //
+  if ( ! ok ) {
+    for (int k = 0; k < opened; k++) {
+      unlink(outputFiles[k]);
+    }
+  }
+  cs1300image_delete(ring);
+  cs1300image_delete(out);
+  return ok ? (long long) width * height : 0;
+}
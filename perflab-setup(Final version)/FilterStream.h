@@ -0,0 +1,23 @@
+//-*-c++-*-
+#ifndef _FilterStream_h_
+#define _FilterStream_h_
+
+#include "cs1300bmp.h"
+#include "FilterKernels.h"
+
+//
+// Filters a BMP file straight from disk to disk without holding the
+// image. Input lines are read into a ring of planar rows just tall
+// enough for the largest filter, and each output row is filtered and
+// written as soon as the rows around it have been read, so memory grows
+// with the width and the filter size but not the height.
+//
+// Runs COUNT filters over INPUTFILE, stages[k] into outputFiles[k], with
+// the same results as filtering the decoded image. Returns the number of
+// pixels in the input, or 0 if a file could not be read or written, in
+// which case none of the outputs is left on disk.
+//
+long long filterStream(const char *inputFile, const FilterStage *stages, int count,
+		       const char *const *outputFiles);
+
+#endif
@@ -0,0 +1,154 @@
+#include "FilterTrace.h"
+
+#if FILTER_TRACE
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct TraceEvent {
+  const char *name;
+  int arg;
+  long long begin;
+  long long end;
+};
+
+//
+// One thread's spans. Only that thread writes them; head counts every
+// span it has recorded, and is stored after the span so that whoever
+// reads head sees the spans before it.
+//
+struct TraceRing {
+  string thread;
+  atomic<unsigned long> head;
+  TraceEvent events[TRACE_RING_SIZE];
+};
+
+bool traceEnabled = false;
+
+static string traceFilename;
+
+//
+// Every thread's ring, kept after the thread exits so the pipeline's
+// reader and writer still show up
+//
+static mutex ringsLock;
+static vector<TraceRing *> rings;
+static thread_local TraceRing *ring = NULL;
+
+//
+// When recording started, to put the spans in microseconds from there
+//
+static long long startTicks;
+static chrono::steady_clock::time_point startTime;
+
+//
+// The calling thread's ring, made the first time it records
+//
+static TraceRing *
+threadRing()
+{
+  if ( ring == NULL ) {
+    ring = new TraceRing;
+    ring -> head.store(0, memory_order_relaxed);
+    lock_guard<mutex> hold(ringsLock);
+    ring -> thread = "thread " + to_string(rings.size());
+    rings.push_back(ring);
+  }
+  return ring;
+}
+
+bool
+traceStart(const char *filename)
+{
+  traceFilename = filename;
+  startTime = chrono::steady_clock::now();
+  startTicks = rdtscll();
+  traceEnabled = true;
+  return true;
+}
+
+void
+traceThreadName(const char *name)
+{
+  if ( traceEnabled ) {
+    TraceRing *mine = threadRing();
+    lock_guard<mutex> hold(ringsLock);
+    mine -> thread = name;
+  }
+}
+
+void
+traceRecord(const char *name, int arg, long long begin, long long end)
+{
+  TraceRing *mine = threadRing();
+  unsigned long head = mine -> head.load(memory_order_relaxed);
+  TraceEvent &event = mine -> events[head & (TRACE_RING_SIZE - 1)];
+  event.name = name;
+  event.arg = arg;
+  event.begin = begin;
+  event.end = end;
+  mine -> head.store(head + 1, memory_order_release);
+}
+
+//
+// Spans still in a ring when recording stops are written; a thread that
+// is still recording may overwrite its oldest ones meanwhile, so traceStop
+// belongs after the work it traces has finished
+//
+void
+traceStop()
+{
+  if ( ! traceEnabled ) {
+    return;
+  }
+  traceEnabled = false;
+  chrono::duration<double, micro> took = chrono::steady_clock::now() - startTime;
+  long long ticks = rdtscll() - startTicks;
+  double microsPerTick = ticks > 0 ? took.count() / ticks : 0.0;
+
+  FILE *file = fopen(traceFilename.c_str(), "w");
+  if ( file == NULL ) {
+    fprintf(stderr, "Could not write %s\n", traceFilename.c_str());
+    return;
+  }
+  lock_guard<mutex> hold(ringsLock);
+  unsigned long written = 0;
+  unsigned long dropped = 0;
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  for (unsigned int t = 0; t < rings.size(); t++) {
+    TraceRing *r = rings[t];
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+	    "\"args\": {\"name\": \"%s\"}}", t > 0 ? ",\n" : "", t, r -> thread.c_str());
+    unsigned long head = r -> head.load(memory_order_acquire);
+    unsigned long first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    dropped += first;
+    for (unsigned long i = first; i < head; i++) {
+      TraceEvent &event = r -> events[i & (TRACE_RING_SIZE - 1)];
+      fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+	      "\"ts\": %.3f, \"dur\": %.3f",
+	      event.name, t, (event.begin - startTicks) * microsPerTick,
+	      (event.end - event.begin) * microsPerTick);
+      if ( event.arg >= 0 ) {
+	fprintf(file, ", \"args\": {\"index\": %d}", event.arg);
+      }
+      fprintf(file, "}");
+      written++;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  fprintf(stderr, "Wrote %lu trace events from %d threads to %s", written, (int) rings.size(),
+	  traceFilename.c_str());
+  if ( dropped > 0 ) {
+    fprintf(stderr, " (%lu older ones overwritten)", dropped);
+  }
+  fprintf(stderr, "\n");
+}
+
+#endif
@@ -0,0 +1,81 @@
+//-*-c++-*-
+#ifndef _FilterTrace_h_
+#define _FilterTrace_h_
+
+//
+// A timeline of what each thread did, written as Chrome trace-event
+// JSON that chrome://tracing or Perfetto can load. Code marks a span
+// with TRACE_SPAN(name, arg), which records when the enclosing scope
+// began and ended. Each thread keeps its spans in a ring of its own, so
+// recording takes no lock; when a ring fills, its oldest spans are
+// overwritten.
+//
+// Until traceStart is called a span costs a test of a flag. Build with
+// -DFILTER_TRACE=0 to compile the recording out altogether.
+//
+#ifndef FILTER_TRACE
+#define FILTER_TRACE 1
+#endif
+
+#if FILTER_TRACE
+
+#include "rdtsc.h"
+
+//
+// Spans each thread keeps; a power of two
+//
+#define TRACE_RING_SIZE (1 << 16)
+
+extern bool traceEnabled;
+
+//
+// Starts recording, for traceStop to write to FILENAME; returns false
+// if tracing was compiled out
+//
+bool traceStart(const char *filename);
+
+//
+// Stops recording and writes what every thread recorded
+//
+void traceStop();
+
+//
+// Names the calling thread on the timeline
+//
+void traceThreadName(const char *name);
+
+//
+// Adds a span NAME, with ARG to tell it from others of the name (or -1
+// for none), that ran from BEGIN to END ticks on the calling thread.
+// NAME must outlive the trace.
+//
+void traceRecord(const char *name, int arg, long long begin, long long end);
+
+class TraceSpan {
+  const char *name;
+  int arg;
+  long long begin;
+
+public:
+  TraceSpan(const char *name, int arg) : name(name), arg(arg), begin(traceEnabled ? rdtscll() : 0) {
+  }
+  ~TraceSpan() {
+    if ( begin ) {
+      traceRecord(name, arg, begin, rdtscll());
+    }
+  }
+};
+
+#define TRACE_SPAN(name, arg) TraceSpan traceSpan(name, arg)
+
+#else
+
+inline bool traceStart(const char *filename) { return false; }
+inline void traceStop() { }
+inline void traceThreadName(const char *name) { }
+
+#define TRACE_SPAN(name, arg)
+
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+#include "ImageCache.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+ImageCache::ImageCache(size_t capacity)
+  : capacity(capacity), used(0), hitCount(0), missCount(0)
+{
+}
+
+ImageCache::~ImageCache()
+{
+  for (list<Entry>::iterator entry = entries.begin(); entry != entries.end(); entry++) {
+    cs1300image_delete(entry -> image);
+  }
+  for (list<Entry>::iterator entry = dropped.begin(); entry != dropped.end(); entry++) {
+    cs1300image_delete(entry -> image);
+  }
+}
+
+void
+ImageCache::drop(list<Entry>::iterator entry)
+{
+  used -= entry -> image -> capacity;
+  byPath.erase(entry -> path);
+  if ( entry -> users > 0 ) {
+    dropped.splice(dropped.begin(), entries, entry);
+  } else {
+    cs1300image_delete(entry -> image);
+    entries.erase(entry);
+  }
+}
+
+//
+// The entry for FILENAME if it was read while the file looked like INFO,
+// else end(); a stale entry is dropped. The lock must be held.
+//
+list<ImageCache::Entry>::iterator
+ImageCache::find(const char *filename, struct stat *info)
+{
+  map<string, list<Entry>::iterator>::iterator found = byPath.find(filename);
+  if ( found == byPath.end() ) {
+    return entries.end();
+  }
+  list<Entry>::iterator entry = found -> second;
+  if ( entry -> device == info -> st_dev && entry -> inode == info -> st_ino
+       && entry -> size == info -> st_size
+       && entry -> modified.tv_sec == info -> st_mtim.tv_sec
+       && entry -> modified.tv_nsec == info -> st_mtim.tv_nsec ) {
+    return entry;
+  }
+  //
+  // The file has changed since it was read
+  //
+  drop(entry);
+  return entries.end();
+}
+
+cs1300image *
+ImageCache::load(const char *filename)
+{
+  //
+  // The key comes from the file that is then decoded, not from the name,
+  // so a file replaced in between cannot be cached as the one before it
+  //
+  struct stat info;
+  int fd = open(filename, O_RDONLY);
+  if ( fd < 0 || fstat(fd, &info) != 0 ) {
+    if ( fd >= 0 ) {
+      close(fd);
+    }
+    //
+    // Let the reader report it
+    //
+    cs1300image *image = cs1300image_new(0, 0);
+    cs1300image_readfile((char *) filename, image);
+    cs1300image_delete(image);
+    return NULL;
+  }
+
+  {
+    lock_guard<mutex> hold(lock);
+    list<Entry>::iterator entry = find(filename, &info);
+    if ( entry != entries.end() ) {
+      close(fd);
+      hitCount++;
+      entry -> users++;
+      entries.splice(entries.begin(), entries, entry);
+      return entry -> image;
+    }
+    missCount++;
+  }
+
+  //
+  // Decoded without the lock, so other threads can use the cache
+  // meanwhile
+  //
+  cs1300image *image = cs1300image_new(0, 0);
+  bool ok = cs1300image_readfd(fd, image);
+  close(fd);
+  if ( ! ok ) {
+    cs1300image_delete(image);
+    return NULL;
+  }
+
+  lock_guard<mutex> hold(lock);
+  list<Entry>::iterator entry = find(filename, &info);
+  if ( entry != entries.end() ) {
+    //
+    // Another thread read the same file first
+    //
+    cs1300image_delete(image);
+    entry -> users++;
+    entries.splice(entries.begin(), entries, entry);
+    return entry -> image;
+  }
+
+  Entry added;
+  added.path = filename;
+  added.device = info.st_dev;
+  added.inode = info.st_ino;
+  added.size = info.st_size;
+  added.modified = info.st_mtim;
+  added.image = image;
+  added.users = 1;
+  entries.push_front(added);
+  byPath[added.path] = entries.begin();
+  used += image -> capacity;
+
+  list<Entry>::iterator oldest = entries.end();
+  while ( used > capacity && oldest != entries.begin() ) {
+    entry = --oldest;
+    if ( entry -> users == 0 ) {
+      oldest++;
+      drop(entry);
+    }
+  }
+  return image;
+}
+
+void
+ImageCache::release(cs1300image *image)
+{
+  lock_guard<mutex> hold(lock);
+  for (list<Entry>::iterator entry = entries.begin(); entry != entries.end(); entry++) {
+    if ( entry -> image == image ) {
+      entry -> users--;
+      return;
+    }
+  }
+  for (list<Entry>::iterator entry = dropped.begin(); entry != dropped.end(); entry++) {
+    if ( entry -> image == image ) {
+      if ( --entry -> users == 0 ) {
+	cs1300image_delete(entry -> image);
+	dropped.erase(entry);
+      }
+      return;
+    }
+  }
+}
+
+unsigned long
+ImageCache::hits()
+{
+  return hitCount;
+}
+
+unsigned long
+ImageCache::misses()
+{
+  return missCount;
+}
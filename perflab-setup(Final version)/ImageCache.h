@@ -0,0 +1,74 @@
+//-*-c++-*-
+#ifndef _ImageCache_h_
+#define _ImageCache_h_
+
+#include "cs1300bmp.h"
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+//
+// Decoded images kept in memory, so loading a file that was loaded
+// before costs an open and a stat instead of a decode. An entry is only
+// used while the file keeps the inode, size and modification time it had
+// when it was read; otherwise it is read again. When the images held take more
+// than the cap, the least recently loaded ones are dropped, except those
+// still in use. Any number of threads may load and release at once.
+//
+class ImageCache {
+  struct Entry {
+    string path;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    cs1300image *image;
+    //
+    // Loads not yet released
+    //
+    int users;
+  };
+
+  mutex lock;
+  //
+  // Most recently loaded first
+  //
+  list<Entry> entries;
+  map<string, list<Entry>::iterator> byPath;
+  //
+  // Entries dropped while in use, deleted when their last user releases
+  // them
+  //
+  list<Entry> dropped;
+  size_t capacity;
+  size_t used;
+  unsigned long hitCount;
+  unsigned long missCount;
+
+  void drop(list<Entry>::iterator entry);
+  list<Entry>::iterator find(const char *filename, struct stat *info);
+
+public:
+  //
+  // Holds up to CAPACITY bytes of pixels
+  //
+  ImageCache(size_t capacity);
+  ~ImageCache();
+
+  //
+  // The decoded pixels of FILENAME, or NULL if it cannot be read. The
+  // image belongs to the cache and stays valid until it is released;
+  // the one just loaded is kept even if it alone is over the cap.
+  //
+  cs1300image *load(const char *filename);
+  void release(cs1300image *image);
+
+  unsigned long hits();
+  unsigned long misses();
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "PerfCounters.h"
+#include "rdtsc.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+//
+// The events, in the order of the fields after ticks; countersRead
+// reads them by index
+//
+#define COUNTER_EVENTS 5
+
+static const struct {
+  unsigned int type;
+  unsigned long long config;
+} events[COUNTER_EVENTS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static bool enabled = false;
+
+//
+// The counters of one thread, closed when it exits
+//
+struct ThreadCounters {
+  bool opened;
+  int fd[COUNTER_EVENTS];
+  CounterSample adopted;
+
+  ThreadCounters() : opened(false) {
+    memset(&adopted, 0, sizeof(adopted));
+    for (int e = 0; e < COUNTER_EVENTS; e++) {
+      fd[e] = -1;
+    }
+  }
+  ~ThreadCounters() {
+    for (int e = 0; e < COUNTER_EVENTS; e++) {
+      if ( fd[e] >= 0 ) {
+	close(fd[e]);
+      }
+    }
+  }
+
+  //
+  // Each event is opened on its own, so one the CPU lacks does not take
+  // the others with it. User time only, which is all an unprivileged
+  // process may count.
+  //
+  void open() {
+    opened = true;
+    for (int e = 0; e < COUNTER_EVENTS; e++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[e].type;
+      attr.config = events[e].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+  }
+
+  //
+  // The count of event E so far, scaled up if the kernel had to share
+  // the counter with other events for part of the time
+  //
+  long long value(int e) {
+    unsigned long long data[3];
+    if ( fd[e] < 0 || read(fd[e], data, sizeof(data)) != sizeof(data) ) {
+      return 0;
+    }
+    if ( data[2] == 0 ) {
+      return 0;
+    }
+    if ( data[2] < data[1] ) {
+      return (long long) ((double) data[0] * data[1] / data[2]);
+    }
+    return data[0];
+  }
+};
+
+static thread_local ThreadCounters counters;
+
+void
+countersEnable()
+{
+  enabled = true;
+}
+
+bool
+countersEnabled()
+{
+  return enabled;
+}
+
+bool
+countersHardware()
+{
+  if ( enabled && ! counters.opened ) {
+    counters.open();
+  }
+  return counters.fd[0] >= 0 && counters.fd[1] >= 0;
+}
+
+void
+countersRead(CounterSample *sample)
+{
+  memset(sample, 0, sizeof(*sample));
+  if ( enabled ) {
+    if ( ! counters.opened ) {
+      counters.open();
+    }
+    const CounterSample &adopted = counters.adopted;
+    sample -> cycles = counters.value(0) + adopted.cycles;
+    sample -> instructions = counters.value(1) + adopted.instructions;
+    sample -> l1dMisses = counters.value(2) + adopted.l1dMisses;
+    sample -> llcMisses = counters.value(3) + adopted.llcMisses;
+    sample -> branchMisses = counters.value(4) + adopted.branchMisses;
+  }
+  sample -> ticks = rdtscpll();
+}
+
+void
+countersDiff(const CounterSample *end, const CounterSample *start, CounterSample *diff)
+{
+  diff -> ticks = end -> ticks - start -> ticks;
+  diff -> cycles = end -> cycles - start -> cycles;
+  diff -> instructions = end -> instructions - start -> instructions;
+  diff -> l1dMisses = end -> l1dMisses - start -> l1dMisses;
+  diff -> llcMisses = end -> llcMisses - start -> llcMisses;
+  diff -> branchMisses = end -> branchMisses - start -> branchMisses;
+}
+
+void
+countersAdd(CounterSample *total, const CounterSample *part)
+{
+  total -> ticks += part -> ticks;
+  total -> cycles += part -> cycles;
+  total -> instructions += part -> instructions;
+  total -> l1dMisses += part -> l1dMisses;
+  total -> llcMisses += part -> llcMisses;
+  total -> branchMisses += part -> branchMisses;
+}
+
+void
+countersAdopt(const CounterSample *part)
+{
+  long long ticks = counters.adopted.ticks;
+  countersAdd(&counters.adopted, part);
+  counters.adopted.ticks = ticks;
+}
+
+void
+countersReport(const char *stage, const CounterSample *sample, double pixels, double bytes)
+{
+  if ( pixels <= 0 ) {
+    return;
+  }
+  if ( ! countersHardware() ) {
+    fprintf(stderr, "%s: %.2f ticks per pixel, %.3f bytes per tick (TSC only, no hardware counters)\n",
+	    stage, sample -> ticks / pixels, sample -> ticks > 0 ? bytes / sample -> ticks : 0.0);
+    return;
+  }
+  fprintf(stderr, "%s: %.2f cycles per pixel, IPC %.2f, per pixel %.4f L1d misses, %.4f LLC misses,"
+	  " %.4f branch misses, %.3f bytes per cycle\n",
+	  stage, sample -> cycles / pixels,
+	  sample -> cycles > 0 ? (double) sample -> instructions / sample -> cycles : 0.0,
+	  sample -> l1dMisses / pixels, sample -> llcMisses / pixels, sample -> branchMisses / pixels,
+	  sample -> cycles > 0 ? bytes / sample -> cycles : 0.0);
+}
@@ -0,0 +1,62 @@
+//-*-c++-*-
+#ifndef _PerfCounters_h_
+#define _PerfCounters_h_
+
+//
+// Hardware event counts for stretches of code, read through
+// perf_event_open. Each thread opens its own counters the first time
+// it reads them, and a ThreadPool hands what its workers counted back
+// to the thread that called run(), so a stretch that runs a pool counts
+// the work of all of it. Where the kernel does not give out a counter
+// (no PMU under a VM, or perf_event_paranoid), that count stays 0, and
+// ticks, from the TSC, is always there.
+//
+struct CounterSample {
+  //
+  // TSC ticks on the thread that reads, not added up over threads
+  //
+  long long ticks;
+  long long cycles;
+  long long instructions;
+  long long l1dMisses;
+  long long llcMisses;
+  long long branchMisses;
+};
+
+//
+// Turns counting on; until then countersRead only reads the TSC and
+// pools pass nothing back
+//
+void countersEnable();
+bool countersEnabled();
+
+//
+// True if this thread has the cycle and instruction counters
+//
+bool countersHardware();
+
+//
+// The counts so far on this thread, and from pools it ran
+//
+void countersRead(CounterSample *sample);
+
+//
+// DIFF = END - START, and TOTAL += PART
+//
+void countersDiff(const CounterSample *end, const CounterSample *start, CounterSample *diff);
+void countersAdd(CounterSample *total, const CounterSample *part);
+
+//
+// Adds PART, counted by another thread on behalf of this one, to what
+// countersRead gives on this thread; its ticks are left out
+//
+void countersAdopt(const CounterSample *part);
+
+//
+// Prints one line on stderr for STAGE: IPC, misses per pixel and bytes
+// per cycle over PIXELS pixels, BYTES of which were read or written.
+// Without hardware counters it gives ticks instead of cycles.
+//
+void countersReport(const char *stage, const CounterSample *sample, double pixels, double bytes);
+
+#endif
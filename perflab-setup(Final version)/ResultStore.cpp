@@ -0,0 +1,347 @@
+#include "ResultStore.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+//
+// The hash is xxHash64's: four lanes over 32-byte blocks, then 8-byte
+// words and single bytes, then a final mix. It runs near memory speed,
+// which keeps a lookup cheap next to filtering.
+//
+static const unsigned long long prime1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long prime3 = 0x165667B19E3779F9ULL;
+static const unsigned long long prime4 = 0x85EBCA77C2B2AE63ULL;
+static const unsigned long long prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline unsigned long long
+rotl(unsigned long long x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long
+word(const unsigned char *p)
+{
+  unsigned long long w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline unsigned long long
+hashRound(unsigned long long acc, unsigned long long input)
+{
+  return rotl(acc + input * prime2, 31) * prime1;
+}
+
+static inline unsigned long long
+merge(unsigned long long acc, unsigned long long lane)
+{
+  return (acc ^ hashRound(0, lane)) * prime1 + prime4;
+}
+
+static unsigned long long
+hashBytes(const unsigned char *p, size_t n, unsigned long long seed)
+{
+  const unsigned char *end = p + n;
+  unsigned long long h;
+
+  if ( n >= 32 ) {
+    unsigned long long v1 = seed + prime1 + prime2;
+    unsigned long long v2 = seed + prime2;
+    unsigned long long v3 = seed;
+    unsigned long long v4 = seed - prime1;
+    for ( ; p + 32 <= end; p += 32) {
+      v1 = hashRound(v1, word(p));
+      v2 = hashRound(v2, word(p + 8));
+      v3 = hashRound(v3, word(p + 16));
+      v4 = hashRound(v4, word(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  } else {
+    h = seed + prime5;
+  }
+  h += n;
+
+  for ( ; p + 8 <= end; p += 8) {
+    h = rotl(h ^ hashRound(0, word(p)), 27) * prime1 + prime4;
+  }
+  for ( ; p < end; p++) {
+    h = rotl(h ^ (*p * prime5), 11) * prime1;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+//
+// Entries end in .bmp; anything else, such as an entry still being
+// made, is left alone
+//
+static bool
+isEntry(const char *name)
+{
+  size_t length = strlen(name);
+  return length > 4 && strcmp(name + length - 4, ".bmp") == 0;
+}
+
+ResultStore::ResultStore(string directory, unsigned long long limit)
+  : directory(directory), limit(limit), used(0),
+    hitCount(0), missCount(0), storeCount(0), evictCount(0), temporaries(0)
+{
+  if ( mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST ) {
+    fprintf(stderr, "Cannot create result store %s: %s\n", directory.c_str(), strerror(errno));
+  }
+  DIR *dir = opendir(directory.c_str());
+  if ( dir ) {
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) != NULL ) {
+      struct stat info;
+      string path = directory + "/" + entry -> d_name;
+      if ( isEntry(entry -> d_name) && stat(path.c_str(), &info) == 0 ) {
+	used += info.st_size;
+      }
+    }
+    closedir(dir);
+  }
+}
+
+unsigned long long
+ResultStore::hashImage(cs1300image *image)
+{
+  unsigned long long h = hashBytes(NULL, 0, ((unsigned long long) image -> width << 32) | image -> height);
+  vector<unsigned char> bytes(image -> width);
+  for (int plane = 0; plane < 3; plane++) {
+    for (int row = 0; row < image -> height; row++) {
+      const cs1300pixel *pixels = cs1300image_row(image, plane, row);
+      if ( sizeof(cs1300pixel) == 1 ) {
+	h = hashBytes((const unsigned char *) pixels, image -> width, h);
+      } else {
+	for (int col = 0; col < image -> width; col++) {
+	  bytes[col] = pixels[col];
+	}
+	h = hashBytes(bytes.data(), image -> width, h);
+      }
+    }
+  }
+  return h;
+}
+
+unsigned long long
+ResultStore::hashImage(const cs1300view *view)
+{
+  //
+  // Each row is split into planes first, so the hash matches the one
+  // of the decoded image
+  //
+  unsigned long long h = hashBytes(NULL, 0, ((unsigned long long) view -> width << 32) | view -> height);
+  vector<unsigned char> bytes(view -> width);
+  for (int plane = 0; plane < 3; plane++) {
+    for (int row = 0; row < view -> height; row++) {
+      const unsigned char *pixels = cs1300view_row(view, row) + CS1300VIEW_OFFSET(plane);
+      for (int col = 0; col < view -> width; col++) {
+	bytes[col] = pixels[3 * col];
+      }
+      h = hashBytes(bytes.data(), view -> width, h);
+    }
+  }
+  return h;
+}
+
+unsigned long long
+ResultStore::hashFilter(Filter *filter)
+{
+  int size = filter -> getSize();
+  vector<int> values;
+  values.push_back(size);
+  values.push_back(max(filter -> getDivisor(), 1));
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j < size; j++) {
+      values.push_back(filter -> get(i, j));
+    }
+  }
+  return hashBytes((const unsigned char *) values.data(), values.size() * sizeof(int), 0);
+}
+
+unsigned long long
+ResultStore::hashChain(unsigned long long a, unsigned long long b)
+{
+  unsigned long long pair[2] = { a, b };
+  return hashBytes((const unsigned char *) pair, sizeof(pair), 0);
+}
+
+string
+ResultStore::entryPath(unsigned long long imageHash, unsigned long long filterHash)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx-%016llx.bmp", imageHash, filterHash);
+  return directory + name;
+}
+
+//
+// Copies FROM to TO, for when they cannot be linked. TO must not exist:
+// it could be a link to some other file, which truncating would empty.
+//
+static bool
+copyFile(const char *from, const char *to)
+{
+  int in = open(from, O_RDONLY);
+  if ( in < 0 ) {
+    return false;
+  }
+  int out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if ( out < 0 ) {
+    close(in);
+    return false;
+  }
+  char buffer[1 << 16];
+  ssize_t got;
+  bool ok = true;
+  while ( ok && (got = read(in, buffer, sizeof(buffer))) > 0 ) {
+    ok = write(out, buffer, got) == got;
+  }
+  ok = ok && got == 0;
+  close(in);
+  close(out);
+  return ok;
+}
+
+bool
+ResultStore::fetch(unsigned long long imageHash, unsigned long long filterHash, string outputFile)
+{
+  string path = entryPath(imageHash, filterHash);
+  //
+  // The output is about to be replaced either way
+  //
+  lock_guard<mutex> hold(lock);
+  unlink(outputFile.c_str());
+  if ( link(path.c_str(), outputFile.c_str()) != 0
+       && ( errno == ENOENT || ! copyFile(path.c_str(), outputFile.c_str()) ) ) {
+    missCount++;
+    return false;
+  }
+  //
+  // The modification time of an entry is when it was last used
+  //
+  utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+  hitCount++;
+  return true;
+}
+
+void
+ResultStore::store(unsigned long long imageHash, unsigned long long filterHash, string outputFile)
+{
+  string path = entryPath(imageHash, filterHash);
+  string temporary;
+  {
+    //
+    // One thread stores an entry at a time; the others have nothing to
+    // add, since the entry is the same output
+    //
+    lock_guard<mutex> hold(lock);
+    if ( ! storing.insert(path).second ) {
+      return;
+    }
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%lu.tmp", (int) getpid(), temporaries++);
+    temporary = path + suffix;
+  }
+
+  //
+  // Made under another name and renamed, so other processes sharing
+  // the directory never see part of an entry
+  //
+  struct stat info;
+  bool made = ( link(outputFile.c_str(), temporary.c_str()) == 0
+		|| copyFile(outputFile.c_str(), temporary.c_str()) )
+    && stat(temporary.c_str(), &info) == 0;
+
+  lock_guard<mutex> hold(lock);
+  storing.erase(path);
+  if ( ! made ) {
+    unlink(temporary.c_str());
+    return;
+  }
+  struct stat old;
+  if ( stat(path.c_str(), &old) == 0 ) {
+    used -= min((unsigned long long) old.st_size, used);
+  }
+  bool renamed = rename(temporary.c_str(), path.c_str()) == 0;
+  //
+  // When both names are links to the same file, rename does nothing and
+  // leaves the temporary name behind
+  //
+  unlink(temporary.c_str());
+  if ( ! renamed ) {
+    return;
+  }
+  utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+  used += info.st_size;
+  storeCount++;
+  if ( used > limit ) {
+    evict();
+  }
+}
+
+void
+ResultStore::evict()
+{
+  struct Entry {
+    struct timespec lastUse;
+    string path;
+    off_t size;
+    bool operator<(const Entry &other) const {
+      return lastUse.tv_sec != other.lastUse.tv_sec ? lastUse.tv_sec < other.lastUse.tv_sec
+	: lastUse.tv_nsec < other.lastUse.tv_nsec;
+    }
+  };
+  vector<Entry> entries;
+
+  //
+  // Count again from the directory, since other processes may share it
+  //
+  used = 0;
+  DIR *dir = opendir(directory.c_str());
+  if ( dir == NULL ) {
+    return;
+  }
+  struct dirent *found;
+  while ( (found = readdir(dir)) != NULL ) {
+    Entry entry;
+    struct stat info;
+    entry.path = directory + "/" + found -> d_name;
+    if ( isEntry(found -> d_name) && stat(entry.path.c_str(), &info) == 0 ) {
+      entry.lastUse = info.st_mtim;
+      entry.size = info.st_size;
+      entries.push_back(entry);
+      used += info.st_size;
+    }
+  }
+  closedir(dir);
+
+  sort(entries.begin(), entries.end());
+  for (size_t i = 0; i < entries.size() && used > limit; i++) {
+    if ( unlink(entries[i].path.c_str()) == 0 ) {
+      used -= entries[i].size;
+      evictCount++;
+    }
+  }
+}
+
+void
+ResultStore::report()
+{
+  fprintf(stderr, "Result store: %lu hits, %lu misses, %lu stored, %lu evicted, %.1f of %.1f MB used\n",
+	  hitCount, missCount, storeCount, evictCount, used / 1048576.0, limit / 1048576.0);
+}
@@ -0,0 +1,84 @@
+//-*-c++-*-
+#ifndef _ResultStore_h_
+#define _ResultStore_h_
+
+#include "cs1300bmp.h"
+#include "Filter.h"
+#include <mutex>
+#include <set>
+#include <string>
+
+using namespace std;
+
+//
+// Filtered images kept in a directory, so running a filter on an image
+// it has already seen links the earlier output into place instead of
+// filtering again. Entries are named after a hash of the decoded input
+// pixels and a hash of the filter. When the directory holds more than
+// its limit, the entries used longest ago are removed. Any number of
+// threads may fetch and store at once.
+//
+class ResultStore {
+  mutex lock;
+  string directory;
+  unsigned long long limit;
+  //
+  // Bytes of entries in the directory, counted when it is opened and
+  // kept up to date after
+  //
+  unsigned long long used;
+  unsigned long hitCount;
+  unsigned long missCount;
+  unsigned long storeCount;
+  unsigned long evictCount;
+  //
+  // Entries some thread is storing now, and a count that makes each
+  // temporary name unique
+  //
+  set<string> storing;
+  unsigned long temporaries;
+
+  string entryPath(unsigned long long imageHash, unsigned long long filterHash);
+  void evict();
+
+public:
+  //
+  // Uses DIRECTORY, creating it if needed, for up to LIMIT bytes of
+  // entries
+  //
+  ResultStore(string directory, unsigned long long limit);
+
+  //
+  // Hashes of the pixels of an image, the same for a decoded image and
+  // a mapped file with the same pixels
+  //
+  static unsigned long long hashImage(cs1300image *image);
+  static unsigned long long hashImage(const cs1300view *view);
+  //
+  // Hash of what a filter does: its size, coefficients and divisor,
+  // with every divisor of 1 or less, which all mean no division, as 1
+  //
+  static unsigned long long hashFilter(Filter *filter);
+  //
+  // Hash of running the filters with hashes A and then B
+  //
+  static unsigned long long hashChain(unsigned long long a, unsigned long long b);
+
+  //
+  // Puts the stored output for the pair at OUTPUTFILE and returns true,
+  // or returns false if there is none
+  //
+  bool fetch(unsigned long long imageHash, unsigned long long filterHash, string outputFile);
+
+  //
+  // Keeps OUTPUTFILE, just written, as the output for the pair
+  //
+  void store(unsigned long long imageHash, unsigned long long filterHash, string outputFile);
+
+  //
+  // Prints the counters and the space used on stderr
+  //
+  void report();
+};
+
+#endif
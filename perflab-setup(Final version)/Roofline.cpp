@@ -0,0 +1,101 @@
+#include "Roofline.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+//
+// Arrays are at least this big even where the cache is small, and no
+// bigger than this where it is huge
+//
+static const size_t probeMinBytes = 64 << 20;
+static const size_t probeMaxBytes = 512 << 20;
+
+struct ProbeJob {
+  const unsigned long long *a;
+  unsigned long long *b;
+  size_t n;
+  int parts;
+  bool copy;
+  //
+  // Each part's sum, so the reads cannot be left out
+  //
+  vector<unsigned long long> sums;
+};
+
+static void
+probePart(int part, void *arg)
+{
+  ProbeJob *job = (ProbeJob *) arg;
+  size_t first = job -> n * part / job -> parts;
+  size_t last = job -> n * (part + 1) / job -> parts;
+  const unsigned long long *a = job -> a;
+
+  if ( job -> copy ) {
+    unsigned long long *b = job -> b;
+    for (size_t i = first; i < last; i++) {
+      b[i] = a[i];
+    }
+  } else {
+    unsigned long long sum = 0;
+    for (size_t i = first; i < last; i++) {
+      sum += a[i];
+    }
+    job -> sums[part] = sum;
+  }
+}
+
+//
+// Seconds the fastest of TRIALS sweeps of JOB took
+//
+static double
+bestSweep(ThreadPool *pool, ProbeJob *job, int trials)
+{
+  double best = 0;
+  for (int trial = 0; trial < trials; trial++) {
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    pool -> run(job -> parts, probePart, job);
+    chrono::duration<double> took = chrono::steady_clock::now() - started;
+    if ( trial == 0 || took.count() < best ) {
+      best = took.count();
+    }
+  }
+  return best;
+}
+
+Bandwidth
+measureBandwidth(ThreadPool *pool, int trials)
+{
+  Bandwidth bandwidth;
+  size_t bytes = min(max(4 * ThreadPool::cacheSize(3), probeMinBytes), probeMaxBytes);
+  size_t n = bytes / sizeof(unsigned long long);
+
+  //
+  // Written once first, so every page is mapped before the timing
+  //
+  vector<unsigned long long> a(n, 1);
+  vector<unsigned long long> b(n, 0);
+
+  ProbeJob job;
+  job.a = a.data();
+  job.b = b.data();
+  job.n = n;
+  job.parts = pool -> size();
+  job.sums.resize(job.parts);
+
+  job.copy = false;
+  bandwidth.read = n * sizeof(unsigned long long) / bestSweep(pool, &job, trials);
+  job.copy = true;
+  bandwidth.copy = 2 * n * sizeof(unsigned long long) / bestSweep(pool, &job, trials);
+  bandwidth.arrayBytes = n * sizeof(unsigned long long);
+  bandwidth.trials = trials;
+  return bandwidth;
+}
+
+double
+filterOperations(Filter *filter)
+{
+  int size = filter -> getSize();
+  return 3.0 * (2 * size * size + (filter -> getDivisor() > 1 ? 1 : 0));
+}
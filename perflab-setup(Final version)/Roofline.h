@@ -0,0 +1,37 @@
+//-*-c++-*-
+#ifndef _Roofline_h_
+#define _Roofline_h_
+
+#include "Filter.h"
+#include "ThreadPool.h"
+#include <stddef.h>
+
+using namespace std;
+
+//
+// What the memory of this machine can deliver, in bytes per second,
+// measured the way STREAM does: every thread of a pool sweeps its part
+// of arrays several times the size of the last-level cache, and the
+// fastest of a few sweeps counts. A copy moves each byte twice, once
+// read and once written.
+//
+struct Bandwidth {
+  double read;
+  double copy;
+  //
+  // Bytes in each array swept
+  //
+  size_t arrayBytes;
+  int trials;
+};
+
+Bandwidth measureBandwidth(ThreadPool *pool, int trials);
+
+//
+// Arithmetic per pixel of FILTER as the filter defines it, a multiply
+// and an add per coefficient and color plus the divide, whatever the
+// engine that runs it saves on that
+//
+double filterOperations(Filter *filter);
+
+#endif
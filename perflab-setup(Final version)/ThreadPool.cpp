@@ -0,0 +1,204 @@
+#include "ThreadPool.h"
+#include "FilterTrace.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+static thread_local int currentWorker = 0;
+
+//
+// Pin the calling thread, worker WORKER of its pool, to one CPU
+//
+static void
+pinToCpu(int worker, int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if ( error != 0 ) {
+    fprintf(stderr, "Could not pin worker %d to CPU %d: %s\n", worker, cpu, strerror(error));
+  }
+}
+
+int
+ThreadPool::worker()
+{
+  return currentWorker;
+}
+
+vector<int>
+ThreadPool::allowedCpus()
+{
+  vector<int> allowed;
+  cpu_set_t set;
+  if ( sched_getaffinity(0, sizeof(set), &set) == 0 ) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if ( CPU_ISSET(cpu, &set) ) {
+	allowed.push_back(cpu);
+      }
+    }
+  }
+  if ( allowed.empty() ) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int cpu = 0; cpu < max(n, 1L); cpu++) {
+      allowed.push_back(cpu);
+    }
+  }
+  return allowed;
+}
+
+int
+ThreadPool::cpus()
+{
+  return allowedCpus().size();
+}
+
+size_t
+ThreadPool::cacheSize(int level)
+{
+  long n = -1;
+  size_t typical = 32 << 10;
+  switch ( level ) {
+  case 1:
+    n = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    break;
+  case 2:
+    n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    typical = 1 << 20;
+    break;
+  default:
+    n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    typical = 8 << 20;
+    break;
+  }
+  return n > 0 ? n : typical;
+}
+
+ThreadPool::ThreadPool(int threads)
+{
+  task = NULL;
+  arg = NULL;
+  count = 0;
+  next = 0;
+  busy = 0;
+  generation = 0;
+  stopping = false;
+  memset(&counted, 0, sizeof(counted));
+  allowed = allowedCpus();
+
+  //
+  // Only the workers made here are pinned; the caller keeps its own
+  // affinity, which the threads it starts later inherit
+  //
+  for (int worker = 1; worker < threads; worker++) {
+    workers.push_back(thread(&ThreadPool::work, this, worker));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    unique_lock<mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (unsigned int i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+int
+ThreadPool::size()
+{
+  return workers.size() + 1;
+}
+
+//
+// Take indices until there are none left
+//
+void
+ThreadPool::drain()
+{
+  for (int index = next++; index < count; index = next++) {
+    task(index, arg);
+  }
+}
+
+void
+ThreadPool::work(int worker)
+{
+  currentWorker = worker;
+  pinToCpu(worker, allowed[worker % allowed.size()]);
+  traceThreadName(("pool worker " + to_string(worker)).c_str());
+
+  unsigned long seen = 0;
+  for (;;) {
+    {
+      unique_lock<mutex> guard(lock);
+      while ( ! stopping && generation == seen ) {
+	wake.wait(guard);
+      }
+      if ( stopping ) {
+	return;
+      }
+      seen = generation;
+    }
+
+    CounterSample start, stop, diff;
+    bool counting = countersEnabled();
+    if ( counting ) {
+      countersRead(&start);
+    }
+    drain();
+    if ( counting ) {
+      countersRead(&stop);
+      countersDiff(&stop, &start, &diff);
+    }
+
+    unique_lock<mutex> guard(lock);
+    if ( counting ) {
+      countersAdd(&counted, &diff);
+    }
+    if ( --busy == 0 ) {
+      done.notify_one();
+    }
+  }
+}
+
+void
+ThreadPool::run(int _count, void (*_task)(int index, void *arg), void *_arg)
+{
+  {
+    unique_lock<mutex> guard(lock);
+    task = _task;
+    arg = _arg;
+    count = _count;
+    next = 0;
+    busy = workers.size();
+    memset(&counted, 0, sizeof(counted));
+    generation++;
+  }
+  wake.notify_all();
+
+  //
+  // The caller is worker 0 of this pool, even if it is a worker of
+  // another one
+  //
+  int caller = currentWorker;
+  currentWorker = 0;
+  drain();
+  currentWorker = caller;
+
+  unique_lock<mutex> guard(lock);
+  while ( busy > 0 ) {
+    done.wait(guard);
+  }
+  if ( countersEnabled() ) {
+    countersAdopt(&counted);
+  }
+}
@@ -0,0 +1,77 @@
+//-*-c++-*-
+#ifndef _ThreadPool_h_
+#define _ThreadPool_h_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "PerfCounters.h"
+
+using namespace std;
+
+//
+// A fixed set of worker threads, created once and reused for every
+// image. Worker i is pinned to the ith CPU its creator may run on, and
+// the thread that calls run() takes part as worker 0, unpinned, so a
+// pool of one thread runs everything inline.
+//
+class ThreadPool {
+  vector<thread> workers;
+  mutex lock;
+  condition_variable wake;
+  condition_variable done;
+
+  void (*task)(int index, void *arg);
+  void *arg;
+  int count;
+  atomic<int> next;
+  int busy;
+  unsigned long generation;
+  bool stopping;
+  //
+  // What the workers counted during the current run, for the caller
+  //
+  CounterSample counted;
+  //
+  // The CPUs the creating thread could run on, the ith for worker i
+  //
+  vector<int> allowed;
+
+  void work(int worker);
+  void drain();
+
+public:
+  ThreadPool(int threads);
+  ~ThreadPool();
+
+  int size();
+
+  //
+  // Calls task(index, arg) for every index in 0 .. count-1, spread over
+  // the threads, and returns once they have all finished. When counting
+  // is on, what the other workers counted is adopted by the caller.
+  //
+  void run(int count, void (*task)(int index, void *arg), void *arg);
+
+  //
+  // Index of the worker the caller is running on; 0 outside the pool
+  //
+  static int worker();
+
+  //
+  // The CPUs the calling thread may run on, from its affinity mask, which
+  // taskset and cgroup cpusets narrow; and how many there are
+  //
+  static vector<int> allowedCpus();
+  static int cpus();
+
+  //
+  // Bytes of data cache at LEVEL (1, 2 or 3) for one CPU, or a typical
+  // size if the system does not say
+  //
+  static size_t cacheSize(int level);
+};
+
+#endif
@@ -1,59 +1,65 @@
 # include <cstdlib>
+# include <cstring>
 # include <iostream>
 # include <iomanip>
 # include <fstream>
+# include <ext/stdio_filebuf.h>
+
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
 
 using namespace std;
 
-extern "C" {
-#    include "cs1300bmp.h"
-}
+#include "cs1300bmp.h"
+#include "rdtsc.h"
 
 //
 // Forward decl's
 //
-static bool bmp_08_data_read ( ifstream &file_in, unsigned long int width, 
-			       long int height,  unsigned char *rarray );
+static bool bmp_08_data_read ( istream &file_in, unsigned long int width, 
+			       long int height, struct cs1300image *image );
 
-static bool bmp_24_data_read ( ifstream &file_in, unsigned long int width, 
-			       long int height, unsigned char *rarray, unsigned char *garray, unsigned char *barray );
-static void bmp_24_data_write ( ofstream &file_out, unsigned long int width, 
-				long int height, unsigned char *rarray, unsigned char *garray, unsigned char *barray );
+static bool bmp_24_data_read ( istream &file_in, unsigned long int width, 
+			       long int height, struct cs1300image *image );
+static bool bmp_data_chunk_read ( istream &file_in, unsigned char *buffer,
+				  size_t nbytes, int padding, bool last, const char *who );
+static bool bmp_24_data_write ( ofstream &file_out, struct cs1300image *image,
+				unsigned char *buffer, size_t buffersize, unsigned char *data );
 
-static bool bmp_header2_read ( ifstream &file_in, unsigned long int *size,
+static bool bmp_header2_read ( istream &file_in, unsigned long int *size,
 			       unsigned long int *width, long int *height, 
 			       unsigned short int *planes, unsigned short int *bitsperpixel,
 			       unsigned long int *compression, unsigned long int *sizeofbitmap,
 			       unsigned long int *horzresolution, unsigned long int *vertresolution,
 			       unsigned long int *colorsused, unsigned long int *colorsimportant );
-static void bmp_header2_write ( ofstream &file_out, unsigned long int size,
+static void bmp_header2_write ( unsigned char *&data, unsigned long int size,
 				unsigned long int width, long int height, 
 				unsigned short int planes, unsigned short int bitsperpixel,
 				unsigned long int compression, unsigned long int sizeofbitmap,
 				unsigned long int horzresolution, unsigned long int vertresolution,
 				unsigned long int colorsused, unsigned long int colorsimportant );
 
-static bool bmp_palette_read ( ifstream &file_in, unsigned long int colorsused,
+static bool bmp_palette_read ( istream &file_in, unsigned long int colorsused,
 			       unsigned char *rparray, unsigned char *gparray, unsigned char *bparray, 
 			       unsigned char *aparray );
-static void bmp_palette_write ( ofstream &file_out, unsigned long int colorsused, 
+static void bmp_palette_write ( unsigned char *&data, unsigned long int colorsused, 
 				unsigned char *rparray, unsigned char *gparray, unsigned char *bparray,
 				unsigned char *aparray );
 
-static bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height, 
-		       unsigned char **rarray, unsigned char **garray, unsigned char **barray );
+static bool bmp_read ( istream &file_in, struct cs1300image *image );
 
-static bool bmp_24_write ( char *file_out_name, unsigned long int width, long int height, 
-			   unsigned char *rarray, unsigned char *garray, unsigned char *barray );
+static bool bmp_24_write ( char *file_out_name, struct cs1300image *image );
 
-static bool long_int_read ( long int *long_int_val, ifstream &file_in );
-static void long_int_write ( long int long_int_val, ofstream &file_out );
+static void long_int_read ( long int *long_int_val, const unsigned char *&data );
+static void long_int_write ( long int long_int_val, unsigned char *&data );
 
-static bool u_long_int_read ( unsigned long int *u_long_int_val, ifstream &file_in );
-static void u_long_int_write ( unsigned long int u_long_int_val, ofstream &file_out );
+static void u_long_int_read ( unsigned long int *u_long_int_val, const unsigned char *&data );
+static void u_long_int_write ( unsigned long int u_long_int_val, unsigned char *&data );
 
-static bool u_short_int_read ( unsigned short int *u_short_int_val, ifstream &file_in );
-static void u_short_int_write ( unsigned short int u_short_int_val, ofstream &file_out );
+static void u_short_int_read ( unsigned short int *u_short_int_val, const unsigned char *&data );
+static void u_short_int_write ( unsigned short int u_short_int_val, unsigned char *&data );
 
 
 //
@@ -66,13 +72,35 @@ static void u_short_int_write ( unsigned short int u_short_int_val, ofstream &fi
 
 static bool bmp_byte_swap = true;
 
+//
+//  BMP_READ_CHUNK is roughly how many bytes of pixel data are read from the
+//  file with each call.  Whole scanlines are always read, so a chunk is at
+//  least one line.
+//
+
+static const size_t bmp_read_chunk = 1 << 20;
+
+//
+//  BMP_WRITE_CHUNK is the size of the buffer the writer encodes lines into
+//  before handing them to the file.
+//
+
+static const size_t bmp_write_chunk = 4 << 20;
+
+//
+//  CONVERT_TICKS is how long this thread has spent splitting file lines
+//  into planes and joining planes into file lines, for cs1300bmp_convertticks.
+//
+
+static thread_local long long convert_ticks = 0;
+
 //****************************************************************************
 
 
 //****************************************************************************
 
-static bool bmp_08_data_read ( ifstream &file_in, unsigned long int width, long int height, 
-			unsigned char *rarray )
+static bool bmp_08_data_read ( istream &file_in, unsigned long int width, long int height, 
+			struct cs1300image *image )
 
   //****************************************************************************
   //
@@ -82,14 +110,14 @@ static bool bmp_08_data_read ( ifstream &file_in, unsigned long int width, long
   // 
   //  Discussion:
   //
-  //    On output, the RGB information in the file has been copied into the
-  //    R, G and B arrays.
+  //    On output, the index values in the file have been copied into all
+  //    three planes of IMAGE.
   //
   //    Thanks to Peter Kionga-Kamau for pointing out an error in the
   //    previous implementation.
   //
-  //    The standard ">>" operator cannot be used to transfer data, because
-  //    it will be deceived by characters that "look like" new lines.
+  //    Scanlines are read in blocks of about BMP_READ_CHUNK bytes with a
+  //    single read each, rather than a byte at a time.
   //
   //    Thanks to Kelly Anderson for pointing out that the program did not handle
   //    monochrome images, but could easily be modified to do so.
@@ -121,79 +149,137 @@ static bool bmp_08_data_read ( ifstream &file_in, unsigned long int width, long
   //
   //  Parameters:
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
   //    Input, unsigned long int WIDTH, the X dimension of the image.
   //
   //    Input, long int HEIGHT, the Y dimension of the image.
   //
-  //    Input, unsigned char *RARRAY, a pointer to the red color arrays.
+  //    Output, struct cs1300image *IMAGE, the image, already sized to
+  //    WIDTH by abs ( HEIGHT ).
   //
   //    Output, bool BMP_08_DATA_READ, is true if an error occurred.
   //
 {
-  char c;
-  bool error;
-  unsigned char *indexr;
-  int numbyte;
   int padding;
   //
   //  Set the padding.
   //
   padding = ( 4 - ( ( 1 * width ) % 4 ) ) % 4;
 
-  indexr = rarray;
-  numbyte = 0;
+  size_t linebytes = width + padding;
+  long int lines = abs ( height );
+  long int chunklines = bmp_read_chunk / linebytes;
 
-  for ( int  j = 0; j < abs ( height ); j++ ) 
+  if ( chunklines < 1 )
     {
-      for ( unsigned int i = 0; i < width; i++ )
-	{
-	  file_in.read ( &c, 1 );
+      chunklines = 1;
+    }
+  if ( lines < chunklines )
+    {
+      chunklines = lines;
+    }
 
-	  error = file_in.eof();
+  unsigned char *buffer = new unsigned char[chunklines * linebytes];
 
-	  if ( error ) 
-	    {
-	      cout << "\n";
-	      cout << "BMP_08_DATA_READ: Fatal error!\n";
-	      cout << "  Failed reading R for pixel (" << i << "," << j << ").\n";
-	      return error;
-	    }
+  for ( long int j = 0; j < lines; j += chunklines )
+    {
+      long int n = min ( chunklines, lines - j );
 
-	  *indexr = ( unsigned char ) c;
-	  numbyte = numbyte + 1;
-	  indexr = indexr + 1;
-	}
-      //
-      //  If necessary, read a few padding characters.
-      //
-      for ( int i = 0; i < padding; i++ )
+      if ( bmp_data_chunk_read ( file_in, buffer, n * linebytes, padding,
+				 j + n == lines, "BMP_08_DATA_READ" ) )
 	{
+	  delete [] buffer;
+	  return true;
+	}
 
-	  file_in.read ( &c, 1 );
+      long long started = rdtscll ( );
 
-	  error = file_in.eof();
+      for ( long int k = 0; k < n; k++ )
+	{
+	  //
+	  //  Files with a negative height are stored top line first.
+	  //
+	  long int row = ( height < 0 ) ? lines - 1 - ( j + k ) : j + k;
+	  unsigned char *line = buffer + k * linebytes;
 
-	  if ( error )
+	  for ( int plane = 0; plane < MAX_COLORS; plane++ )
 	    {
-	      cout << "\n";
-	      cout << "BMP_08_DATA_READ - Warning!\n";
-	      cout << "  Failed while reading padding character " << i << "\n";
-	      cout << "  of total " << padding << " characters\n";
-	      cout << "  at the end of line " << j << "\n";
-	      cout << "\n";
-	      cout << "  This is a minor error.\n";
-	      return false;
+	      cs1300pixel *out = cs1300image_row ( image, plane, row );
+	      for ( unsigned long int i = 0; i < width; i++ )
+		{
+		  out[i] = line[i];
+		}
 	    }
 	}
+      convert_ticks += rdtscll ( ) - started;
     }
 
+  delete [] buffer;
   return false;
 }
 
-static bool bmp_24_data_read ( ifstream &file_in, unsigned long int width, long int height, 
-			unsigned char *rarray, unsigned char *garray, unsigned char *barray )
+
+//****************************************************************************
+
+static bool bmp_data_chunk_read ( istream &file_in, unsigned char *buffer,
+				  size_t nbytes, int padding, bool last, const char *who )
+
+  //****************************************************************************
+  //
+  //  Purpose:
+  //
+  //    BMP_DATA_CHUNK_READ reads a block of whole scanlines with one call.
+  //
+  //  Discussion:
+  //
+  //    A file that ends partway through the padding of its final line is
+  //    accepted, as it always has been; anything shorter is an error.
+  //
+  //  Parameters:
+  //
+  //    Input, istream &FILE_IN, a reference to the input file.
+  //
+  //    Output, unsigned char *BUFFER, receives NBYTES bytes.
+  //
+  //    Input, size_t NBYTES, the size of the block, padding included.
+  //
+  //    Input, int PADDING, the number of padding bytes on each line.
+  //
+  //    Input, bool LAST, is true if the block ends with the final line.
+  //
+  //    Input, const char *WHO, the caller's name for messages.
+  //
+  //    Output, bool BMP_DATA_CHUNK_READ, is true if an error occurred.
+  //
+{
+  file_in.read ( ( char * ) buffer, nbytes );
+
+  size_t got = file_in.gcount ( );
+
+  if ( got == nbytes )
+    {
+      return false;
+    }
+
+  if ( last && nbytes - got <= ( size_t ) padding )
+    {
+      cout << "\n";
+      cout << who << " - Warning!\n";
+      cout << "  Failed while reading padding characters at the end of the image.\n";
+      cout << "\n";
+      cout << "  This is a minor error.\n";
+      return false;
+    }
+
+  cout << "\n";
+  cout << who << ": Fatal error!\n";
+  cout << "  Read " << got << " of " << nbytes << " bytes of pixel data.\n";
+  return true;
+}
+
+static bool bmp_24_data_read ( istream &file_in, unsigned long int width, long int height, 
+			struct cs1300image *image )
 
   //****************************************************************************
   //
@@ -204,13 +290,14 @@ static bool bmp_24_data_read ( ifstream &file_in, unsigned long int width, long
   //  Discussion:
   //
   //    On output, the RGB information in the file has been copied into the
-  //    R, G and B arrays.
+  //    R, G and B planes of IMAGE.
   //
   //    Thanks to Peter Kionga-Kamau for pointing out an error in the
   //    previous implementation.
   //
-  //    The standard ">>" operator cannot be used to transfer data, because
-  //    it will be deceived by characters that "look like" new lines.
+  //    Scanlines are read in blocks of about BMP_READ_CHUNK bytes with a
+  //    single read each, and the interleaved BGR bytes of each line are
+  //    then split into the planes.
   //
   //  Modified:
   // 
@@ -238,119 +325,81 @@ static bool bmp_24_data_read ( ifstream &file_in, unsigned long int width, long
   //
   //  Parameters:
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
   //    Input, unsigned long int WIDTH, the X dimension of the image.
   //
   //    Input, long int HEIGHT, the Y dimension of the image.
   //
-  //    Input, unsigned char *RARRAY, *GARRAY, *BARRAY, pointers to the 
-  //    red, green and blue color arrays.
+  //    Output, struct cs1300image *IMAGE, the image, already sized to
+  //    WIDTH by abs ( HEIGHT ).
   //
   //    Output, bool BMP_24_DATA_READ, is true if an error occurred.
   //
 {
-  char c;
-  bool error;
-  unsigned char *indexb;
-  unsigned char *indexg;
-  unsigned char *indexr;
-  int numbyte;
   int padding;
   //
   //  Set the padding.
   //
   padding = ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
 
-  indexr = rarray;
-  indexg = garray;
-  indexb = barray;
-  numbyte = 0;
+  size_t linebytes = 3 * width + padding;
+  long int lines = abs ( height );
+  long int chunklines = bmp_read_chunk / linebytes;
 
-  for ( int j = 0; j < abs ( height ); j++ ) 
+  if ( chunklines < 1 )
     {
-      for ( unsigned  int i = 0; i < width; i++ )
-	{
-
-	  file_in.read ( &c, 1 );
-
-	  error = file_in.eof();
-
-	  if ( error )
-	    {
-	      cout << "\n";
-	      cout << "BMP_24_DATA_READ: Fatal error!\n";
-	      cout << "  Failed reading B for pixel (" << i << "," << j << ").\n";
-	      return error;
-	    }
-
-	  *indexb = ( unsigned char ) c;
-	  numbyte = numbyte + 1;
-	  indexb = indexb + 1;
-
-	  file_in.read ( &c, 1 );
-
-	  error = file_in.eof();
-
-	  if ( error ) 
-	    {
-	      cout << "\n";
-	      cout << "BMP_24_DATA_READ: Fatal error!\n";
-	      cout << "  Failed reading G for pixel (" << i << "," << j << ").\n";
-	      return error;
-	    }
-
-	  *indexg = ( unsigned char ) c;
-	  numbyte = numbyte + 1;
-	  indexg = indexg + 1;
-
-	  file_in.read ( &c, 1 );
+      chunklines = 1;
+    }
+  if ( lines < chunklines )
+    {
+      chunklines = lines;
+    }
 
-	  error = file_in.eof();
+  unsigned char *buffer = new unsigned char[chunklines * linebytes];
 
-	  if ( error ) 
-	    {
-	      cout << "\n";
-	      cout << "BMP_24_DATA_READ: Fatal error!\n";
-	      cout << "  Failed reading R for pixel (" << i << "," << j << ").\n";
-	      return error;
-	    }
+  for ( long int j = 0; j < lines; j += chunklines )
+    {
+      long int n = min ( chunklines, lines - j );
 
-	  *indexr = ( unsigned char ) c;
-	  numbyte = numbyte + 1;
-	  indexr = indexr + 1;
-	}
-      //
-      //  If necessary, read a few padding characters.
-      //
-      for (  int i = 0; i < padding; i++ )
+      if ( bmp_data_chunk_read ( file_in, buffer, n * linebytes, padding,
+				 j + n == lines, "BMP_24_DATA_READ" ) )
 	{
+	  delete [] buffer;
+	  return true;
+	}
 
-	  file_in.read ( &c, 1 );
-
-	  error = file_in.eof();
+      long long started = rdtscll ( );
 
-	  if ( error )
+      for ( long int k = 0; k < n; k++ )
+	{
+	  //
+	  //  Files with a negative height are stored top line first.
+	  //
+	  long int row = ( height < 0 ) ? lines - 1 - ( j + k ) : j + k;
+	  unsigned char *line = buffer + k * linebytes;
+	  cs1300pixel *red = cs1300image_row ( image, COLOR_RED, row );
+	  cs1300pixel *green = cs1300image_row ( image, COLOR_GREEN, row );
+	  cs1300pixel *blue = cs1300image_row ( image, COLOR_BLUE, row );
+
+	  for ( unsigned long int i = 0; i < width; i++ )
 	    {
-	      cout << "\n";
-	      cout << "BMP_24_DATA_READ - Warning!\n";
-	      cout << "  Failed while reading padding character " << i << "\n";
-	      cout << "  of total " << padding << " characters\n";
-	      cout << "  at the end of line " << j << "\n";
-	      cout << "\n";
-	      cout << "  This is a minor error.\n";
-	      return false;
+	      blue[i] = line[3 * i];
+	      green[i] = line[3 * i + 1];
+	      red[i] = line[3 * i + 2];
 	    }
 	}
+      convert_ticks += rdtscll ( ) - started;
     }
 
+  delete [] buffer;
   return false;
 }
+
 //****************************************************************************
 
-static void bmp_24_data_write ( ofstream &file_out, unsigned long int width, 
-			 long int height, unsigned char *rarray, unsigned char *garray, 
-			 unsigned char *barray )
+static bool bmp_24_data_write ( ofstream &file_out, struct cs1300image *image,
+				unsigned char *buffer, size_t buffersize, unsigned char *data )
 
   //****************************************************************************
   //
@@ -366,6 +415,11 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
   //    appropriate length.  This information, and the corresponding corrective
   //    code, was supplied by Lee Mulcahy.
   //
+  //    Lines are encoded from the planes of IMAGE into BUFFER, which is
+  //    written out with one call whenever the next line would not fit, so
+  //    there is one pass over the image and a few large writes.  BUFFER
+  //    may already hold the headers, up to DATA.
+  //
   //  Modified:
   // 
   //    11 December 2004
@@ -394,51 +448,67 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
   //
   //    Input, ofstream &FILE_OUT, a reference to the output file.
   //
-  //    Input, unsigned long int WIDTH, the X dimension of the image in bytes.
+  //    Input, struct cs1300image *IMAGE, the image.
   //
-  //    Input, long int HEIGHT, the Y dimension of the image in bytes.
+  //    Input, unsigned char *BUFFER, a buffer of BUFFERSIZE bytes, which must
+  //    be able to hold at least one line.
   //
-  //    Input, unsigned char *RARRAY, *GARRAY, *BARRAY, pointers to the red, green
-  //    and blue color arrays.
+  //    Input, unsigned char *DATA, where in BUFFER the data starts.
+  //
+  //    Output, bool BMP_24_DATA_WRITE, is true if an error occurred.
   //
 {
-  unsigned char *indexb;
-  unsigned char *indexg;
-  unsigned char *indexr;
   int padding;
+  unsigned long int width = image -> width;
   //
   //  Set the padding.
   //
   padding = ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
 
-  indexr = rarray;
-  indexg = garray;
-  indexb = barray;
+  size_t linebytes = 3 * width + padding;
+  unsigned char *end = buffer + buffersize;
+  //
+  //  The time spent writing is taken back out of CONVERT_TICKS.
+  //
+  convert_ticks -= rdtscll ( );
 
-  for ( int j = 0; j < abs ( height ); j++ )
+  for ( int j = 0; j < image -> height; j++ )
     {
-      for (unsigned int  i = 0; i < width; i++ )
+      if ( end - data < ( long int ) linebytes )
 	{
-	  file_out << *indexb;
-	  file_out << *indexg;
-	  file_out << *indexr;
+	  long long writing = rdtscll ( );
+	  file_out.write ( ( char * ) buffer, data - buffer );
+	  convert_ticks -= rdtscll ( ) - writing;
+	  data = buffer;
+	}
+
+      cs1300pixel *red = cs1300image_row ( image, COLOR_RED, j );
+      cs1300pixel *green = cs1300image_row ( image, COLOR_GREEN, j );
+      cs1300pixel *blue = cs1300image_row ( image, COLOR_BLUE, j );
 
-	  indexb = indexb + 1;
-	  indexg = indexg + 1;
-	  indexr = indexr + 1;
+      for ( unsigned long int i = 0; i < width; i++ )
+	{
+	  data[3 * i] = ( unsigned char ) blue[i];
+	  data[3 * i + 1] = ( unsigned char ) green[i];
+	  data[3 * i + 2] = ( unsigned char ) red[i];
 	}
 
-      for (int  i = 0; i < padding; i++ )
+      for ( int i = 0; i < padding; i++ )
 	{
-	  file_out << 0;
+	  data[3 * width + i] = 0;
 	}
+      data = data + linebytes;
     }
 
-  return;
+  convert_ticks += rdtscll ( );
+  file_out.write ( ( char * ) buffer, data - buffer );
+
+  return !file_out;
 }
+
 //****************************************************************************
 
- bool bmp_header1_read ( ifstream &file_in, unsigned short int *filetype, 
+ bool bmp_header1_read ( istream &file_in, unsigned short int *filetype, 
 			unsigned long int *filesize, unsigned short int *reserved1, 
 			unsigned short int *reserved2, unsigned long int *bitmapoffset )
 
@@ -458,6 +528,8 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
   //    2 bytes RESERVED2;       Always 0,
   //    4 bytes BITMAPOFFSET.    Starting position of image data, in bytes.
   //
+  //    The whole header is read with one call and then decoded.
+  //
   //  Modified:
   // 
   //    15 December 2004
@@ -484,7 +556,7 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
   //
   //  Parameters:
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
   //    Output, unsigned short int *FILETYPE, the file type.
   //
@@ -497,19 +569,22 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
   //    Output, unsigned long int *BITMAPOFFSET, the bitmap offset.
   //
 {
-  bool error;
+  unsigned char header[14];
+  const unsigned char *data = header;
   char i1;
   char i2;  
-  //
-  //  Read FILETYPE.
-  //
-  error = u_short_int_read ( filetype, file_in );
 
-  if ( error )
+  file_in.read ( ( char * ) header, sizeof ( header ) );
+
+  if ( file_in.gcount ( ) != sizeof ( header ) )
     {
-      return error;
+      return true;
     }
   //
+  //  Read FILETYPE.
+  //
+  u_short_int_read ( filetype, data );
+  //
   //  If you are doing swapping, you have to reunswap the filetype, I think, JVB 15 December 2004.
   //
   if ( bmp_byte_swap )
@@ -519,44 +594,19 @@ static void bmp_24_data_write ( ofstream &file_out, unsigned long int width,
       *filetype = i2 * 256 + i1;
     }
   //
-  //  Read FILESIZE.
-  //
-  error = u_long_int_read ( filesize, file_in );
-  if ( error ) 
-    {
-      return error;
-    }
-  //
-  //  Read RESERVED1.
-  //
-  error = u_short_int_read ( reserved1, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read RESERVED2.
-  //
-  error = u_short_int_read ( reserved2, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read BITMAPOFFSET.
+  //  Read FILESIZE, RESERVED1, RESERVED2 and BITMAPOFFSET.
   //
-  error = u_long_int_read ( bitmapoffset, file_in );
-  if ( error )
-    {
-      return error;
-    }
+  u_long_int_read ( filesize, data );
+  u_short_int_read ( reserved1, data );
+  u_short_int_read ( reserved2, data );
+  u_long_int_read ( bitmapoffset, data );
 
-  error = false;
-  return error;
+  return false;
 }
+
 //****************************************************************************
 
-void bmp_header1_write ( ofstream &file_out, unsigned short int filetype,
+void bmp_header1_write ( unsigned char *&data, unsigned short int filetype,
 			 unsigned long int filesize, unsigned short int reserved1, 
 			 unsigned short int reserved2, unsigned long int bitmapoffset )
 
@@ -564,7 +614,7 @@ void bmp_header1_write ( ofstream &file_out, unsigned short int filetype,
   //
   //  Purpose:
   // 
-  //    BMP_HEADER1_WRITE writes the header information to a BMP file.
+  //    BMP_HEADER1_WRITE writes the header information of a BMP file to a buffer.
   //
   //  Discussion:
   //
@@ -602,7 +652,8 @@ void bmp_header1_write ( ofstream &file_out, unsigned short int filetype,
   //
   //  Parameters:
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
   //    Input, unsigned short int FILETYPE, the file type.
   //
@@ -615,17 +666,17 @@ void bmp_header1_write ( ofstream &file_out, unsigned short int filetype,
   //    Input, unsigned long int BITMAPOFFSET, the bitmap offset.
   //
 {
-  u_short_int_write ( filetype, file_out );
-  u_long_int_write ( filesize, file_out );
-  u_short_int_write ( reserved1, file_out );
-  u_short_int_write ( reserved2, file_out );
-  u_long_int_write ( bitmapoffset, file_out );
+  u_short_int_write ( filetype, data );
+  u_long_int_write ( filesize, data );
+  u_short_int_write ( reserved1, data );
+  u_short_int_write ( reserved2, data );
+  u_long_int_write ( bitmapoffset, data );
 
   return;
 }
 //****************************************************************************
 
-static bool bmp_header2_read ( ifstream &file_in, unsigned long int *size,
+static bool bmp_header2_read ( istream &file_in, unsigned long int *size,
 			unsigned long int *width, long int *height, 
 			unsigned short int *planes, unsigned short int *bitsperpixel,
 			unsigned long int *compression, unsigned long int *sizeofbitmap,
@@ -656,6 +707,8 @@ static bool bmp_header2_read ( ifstream &file_in, unsigned long int *size,
   //    4 bytes COLORSUSED;          Number of colors in palette.  (Can be zero).
   //    4 bytes COLORSIMPORTANT.     Minimum number of important colors. (Can be zero).
   //
+  //    The whole header is read with one call and then decoded.
+  //
   //  Modified:
   // 
   //    03 March 2004
@@ -682,7 +735,7 @@ static bool bmp_header2_read ( ifstream &file_in, unsigned long int *size,
   //
   //  Parameters:
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
   //    Output, unsigned long int *SIZE, the size of this header in bytes.
   //
@@ -709,102 +762,34 @@ static bool bmp_header2_read ( ifstream &file_in, unsigned long int *size,
   //    Output, bool BMP_HEADER2_READ, is true if an error occurred.
   //
 {
-  bool error;
-  //
-  //  Read SIZE, the size of the header in bytes.
-  //
-  error = u_long_int_read ( size, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read WIDTH, the image width in pixels.
-  //
-  error = u_long_int_read ( width, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read HEIGHT, the image height in pixels.
-  //
-  error = long_int_read ( height, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read PLANES, the number of color planes.
-  //
-  error = u_short_int_read ( planes, file_in ); 
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read BITSPERPIXEL.
-  //
-  error = u_short_int_read ( bitsperpixel, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read COMPRESSION.
-  //
-  error = u_long_int_read ( compression, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read SIZEOFBITMAP.
-  //
-  error = u_long_int_read ( sizeofbitmap, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read HORZRESOLUTION.
-  //
-  error = u_long_int_read ( horzresolution, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read VERTRESOLUTION.
-  //
-  error = u_long_int_read ( vertresolution, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read COLORSUSED.
-  //
-  error = u_long_int_read ( colorsused, file_in );
-  if ( error )
-    {
-      return error;
-    }
-  //
-  //  Read COLORSIMPORTANT.
-  //
-  error = u_long_int_read ( colorsimportant, file_in );
-  if ( error )
+  unsigned char header[40];
+  const unsigned char *data = header;
+
+  file_in.read ( ( char * ) header, sizeof ( header ) );
+
+  if ( file_in.gcount ( ) != sizeof ( header ) )
     {
-      return error;
+      return true;
     }
 
-  error = false;
-  return error;
+  u_long_int_read ( size, data );
+  u_long_int_read ( width, data );
+  long_int_read ( height, data );
+  u_short_int_read ( planes, data ); 
+  u_short_int_read ( bitsperpixel, data );
+  u_long_int_read ( compression, data );
+  u_long_int_read ( sizeofbitmap, data );
+  u_long_int_read ( horzresolution, data );
+  u_long_int_read ( vertresolution, data );
+  u_long_int_read ( colorsused, data );
+  u_long_int_read ( colorsimportant, data );
+
+  return false;
 }
+
 //****************************************************************************
 
-static void bmp_header2_write ( ofstream &file_out, unsigned long int size,
+static void bmp_header2_write ( unsigned char *&data, unsigned long int size,
 			 unsigned long int width, long int height, 
 			 unsigned short int planes, unsigned short int bitsperpixel,
 			 unsigned long int compression, unsigned long int sizeofbitmap,
@@ -815,7 +800,7 @@ static void bmp_header2_write ( ofstream &file_out, unsigned long int size,
   //
   //  Purpose:
   // 
-  //    BMP_HEADER2_WRITE writes the bitmap header information to a BMP file.
+  //    BMP_HEADER2_WRITE writes the bitmap header information of a BMP file to a buffer.
   //
   //  Discussion:
   //
@@ -864,7 +849,8 @@ static void bmp_header2_write ( ofstream &file_out, unsigned long int size,
   //
   //  Parameters:
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
   //    Input, unsigned long int SIZE, the size of this header in bytes.
   //
@@ -889,23 +875,23 @@ static void bmp_header2_write ( ofstream &file_out, unsigned long int size,
   //    Input, unsigned long int COLORSIMPORTANT, the minimum number of colors.
   //
 {
-  u_long_int_write ( size, file_out );
-  u_long_int_write ( width, file_out );
-  long_int_write ( height, file_out );
-  u_short_int_write ( planes, file_out ); 
-  u_short_int_write ( bitsperpixel, file_out );
-  u_long_int_write ( compression, file_out );
-  u_long_int_write ( sizeofbitmap, file_out );
-  u_long_int_write ( horzresolution, file_out );
-  u_long_int_write ( vertresolution, file_out );
-  u_long_int_write ( colorsused, file_out );
-  u_long_int_write ( colorsimportant, file_out );
+  u_long_int_write ( size, data );
+  u_long_int_write ( width, data );
+  long_int_write ( height, data );
+  u_short_int_write ( planes, data ); 
+  u_short_int_write ( bitsperpixel, data );
+  u_long_int_write ( compression, data );
+  u_long_int_write ( sizeofbitmap, data );
+  u_long_int_write ( horzresolution, data );
+  u_long_int_write ( vertresolution, data );
+  u_long_int_write ( colorsused, data );
+  u_long_int_write ( colorsimportant, data );
 
   return;
 }
 //****************************************************************************
 
-static bool bmp_palette_read ( ifstream &file_in, unsigned long int colorsused,
+static bool bmp_palette_read ( istream &file_in, unsigned long int colorsused,
 			unsigned char *rparray, unsigned char *gparray, unsigned char *bparray, 
 			unsigned char *aparray )
 
@@ -920,6 +906,8 @@ static bool bmp_palette_read ( ifstream &file_in, unsigned long int colorsused,
   //    There are COLORSUSED colors listed.  For each color, the values of
   //    (B,G,R,A) are listed, where A is a quantity reserved for future use.
   //
+  //    The palette is read with one call and then split into the arrays.
+  //
   //  Modified:
   // 
   //    05 March 2003
@@ -946,7 +934,7 @@ static bool bmp_palette_read ( ifstream &file_in, unsigned long int colorsused,
   //
   //  Parameters:
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
   //    Input, unsigned long int COLORSUSED, the number of colors in the palette.
   //
@@ -956,96 +944,43 @@ static bool bmp_palette_read ( ifstream &file_in, unsigned long int colorsused,
   //    Output, bool BMP_PALETTE_READ, is true if an error occurred.
   //
 {
-  char c;
-  bool error;
-  unsigned char *indexa;
-  unsigned char *indexb;
-  unsigned char *indexg;
-  unsigned char *indexr;
+  size_t nbytes = 4 * colorsused;
+  unsigned char *buffer = new unsigned char[nbytes];
 
-  indexr = rparray;
-  indexg = gparray;
-  indexb = bparray;
-  indexa = aparray;
+  file_in.read ( ( char * ) buffer, nbytes );
 
-  for ( unsigned int i = 0; i < colorsused; i++ )
+  if ( ( size_t ) file_in.gcount ( ) != nbytes )
     {
+      cout << "\n";
+      cout << "BMP_PALETTE_READ: Fatal error!\n";
+      cout << "  Failed reading palette color " << file_in.gcount ( ) / 4 << ".\n";
+      delete [] buffer;
+      return true;
+    }
 
-      file_in.read ( &c, 1 );
-
-      error = file_in.eof();
-
-      if ( error )
-	{
-	  cout << "\n";
-	  cout << "BMP_PALETTE_READ: Fatal error!\n";
-	  cout << "  Failed reading B for palette color " << i << ".\n";
-	  return error;
-	}
-
-      *indexb = ( unsigned char ) c;
-      indexb = indexb + 1;
-
-      file_in.read ( &c, 1 );
-
-      error = file_in.eof();
-
-      if ( error )
-	{
-	  cout << "\n";
-	  cout << "BMP_PALETTE_READ: Fatal error!\n";
-	  cout << "  Failed reading G for palette color " << i << ".\n";
-	  return error;
-	}
+  for ( unsigned int i = 0; i < colorsused; i++ )
+    {
+      bparray[i] = buffer[4 * i];
+      gparray[i] = buffer[4 * i + 1];
+      rparray[i] = buffer[4 * i + 2];
+      aparray[i] = buffer[4 * i + 3];
+    }
 
-      *indexg = ( unsigned char ) c;
-      indexg = indexg + 1;
+  delete [] buffer;
+  return false;
+}
 
-      file_in.read ( &c, 1 );
+//****************************************************************************
 
-      error = file_in.eof();
-
-      if ( error )
-	{
-	  cout << "\n";
-	  cout << "BMP_PALETTE_READ: Fatal error!\n";
-	  cout << "  Failed reading R for palette color " << i << ".\n";
-	  return error;
-	}
-
-      *indexr = ( unsigned char ) c;
-      indexr = indexr + 1;
-
-      file_in.read ( &c, 1 );
-
-      error = file_in.eof();
-
-      if ( error )
-	{
-	  cout << "\n";
-	  cout << "BMP_PALETTE_READ: Fatal error!\n";
-	  cout << "  Failed reading A for palette color " << i << ".\n";
-	  return error;
-	}
-
-      *indexa = ( unsigned char ) c;
-      indexa = indexa + 1;
-    }
-
-  error = false;
-  return error;
-}
-//****************************************************************************
-
-static void bmp_palette_write ( ofstream &file_out, unsigned long int colorsused, 
-			 unsigned char *rparray, unsigned char *gparray, unsigned char *bparray,
-			 unsigned char *aparray )
+static void bmp_palette_write ( unsigned char *&data, unsigned long int colorsused, 
+			 unsigned char *rparray, unsigned char *gparray, unsigned char *bparray,
+			 unsigned char *aparray )
 
   //****************************************************************************
   //
   //  Purpose:
   //  
-  //    BMP_PALETTE_WRITE writes the palette data to the BMP file.
+  //    BMP_PALETTE_WRITE writes the palette data of a BMP file to a buffer.
   // 
   //  Modified:
   // 
@@ -1073,7 +1008,8 @@ static void bmp_palette_write ( ofstream &file_out, unsigned long int colorsused
   //
   //  Parameters:
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
   //    Input, unsigned long int COLORSUSED, the number of colors in the palette.
   //
@@ -1093,10 +1029,11 @@ static void bmp_palette_write ( ofstream &file_out, unsigned long int colorsused
 
   for (unsigned int i = 0; i < colorsused; i++ )
     {
-      file_out << *indexb;
-      file_out << *indexg;
-      file_out << *indexr;
-      file_out << *indexa;
+      data[0] = *indexb;
+      data[1] = *indexg;
+      data[2] = *indexr;
+      data[3] = *indexa;
+      data = data + 4;
 
       indexb = indexb + 1;
       indexg = indexg + 1;
@@ -1110,8 +1047,7 @@ static void bmp_palette_write ( ofstream &file_out, unsigned long int colorsused
 
 //****************************************************************************
 
-bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height, 
-		unsigned char **rarray, unsigned char **garray, unsigned char **barray )
+bool bmp_read ( istream &file_in, struct cs1300image *image )
 
   //****************************************************************************
   //
@@ -1127,6 +1063,13 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
   //    Thanks to Kelly Anderson for discovering that the routine could not read
   //    monochrome images (bitsperpixel = 8 ) and suggesting how to fix that.
   //
+  //    The pixel data is decoded straight into the planes of IMAGE, which
+  //    is resized to fit.  Lines are stored bottom line first whatever the
+  //    sign of the height in the file.
+  //
+  //    The file is read from wherever it was opened, by name or from a
+  //    descriptor; it must be at its start.
+  //
   //  Modified:
   // 
   //    01 April 2005
@@ -1153,14 +1096,9 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
   //
   //  Parameters:
   //
-  //    Input, char *FILE_IN_NAME, the name of the input file.
+  //    Input, istream &FILE_IN, a reference to the input file.
   //
-  //    Output, unsigned long int *WIDTH, the X dimension of the image.
-  //
-  //    Output, long int *HEIGHT, the Y dimension of the image.
-  //
-  //    Output, unsigned char **RARRAY, **GARRAY, **BARRAY, pointers to the red, green
-  //    and blue color arrays.
+  //    Output, struct cs1300image *IMAGE, the image.
   //
   //    Output, bool BMP_READ, is true if an error occurred.
   //
@@ -1173,13 +1111,12 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
   unsigned long int colorsused;
   unsigned long int compression;
   bool error;
-  ifstream file_in;
   unsigned long int filesize;
   unsigned short int filetype;
   unsigned char *gparray;
+  long int height;
   unsigned long int horzresolution;
   unsigned short int magic;
-  int numbytes;
   unsigned short int planes;
   unsigned short int reserved1;
   unsigned short int reserved2;
@@ -1187,11 +1124,10 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
   unsigned long int size;
   unsigned long int sizeofbitmap;
   unsigned long int vertresolution;
+  unsigned long int width;
   //
-  //  Open the input file.
+  //  Check that the input file opened.
   //
-  file_in.open ( file_in_name, ios::in | ios::binary );
-
   if ( !file_in ) 
     {
       error = true;
@@ -1237,7 +1173,7 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
   //
   //  Read header 2.
   //
-  error = bmp_header2_read ( file_in, &size, width, height, &planes,
+  error = bmp_header2_read ( file_in, &size, &width, &height, &planes,
 			     &bitsperpixel, &compression, &sizeofbitmap, &horzresolution,
 			     &vertresolution, &colorsused, &colorsimportant );
 
@@ -1274,19 +1210,35 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
       delete [] aparray;
     }
   //
-  //  Allocate storage.
+  //  The data starts at BITMAPOFFSET, which is past any header fields
+  //  this reader does not know about.
   //
-  numbytes = ( *width ) * ( abs ( *height ) ) * sizeof ( unsigned char );
+  file_in.seekg ( bitmapoffset, ios::beg );
 
-  *rarray = new unsigned char[numbytes];
-  *garray = new unsigned char[numbytes];
-  *barray = new unsigned char[numbytes];
+  if ( !file_in )
+    {
+      cout << "\n";
+      cout << "BMP_READ: Fatal error!\n";
+      cout << "  Could not seek to the image data.\n";
+      return true;
+    }
+  //
+  //  Allocate storage.
+  //
+  if ( width == 0 || 0x7fffffff < width || height == 0 || 0x7fffffff < abs ( height )
+       || !cs1300image_resize ( image, width, abs ( height ) ) )
+    {
+      cout << "\n";
+      cout << "BMP_READ: Fatal error!\n";
+      cout << "  Could not allocate a " << width << " x " << height << " image.\n";
+      return true;
+    }
   //
   //  Read the data.
   //
   if ( bitsperpixel == 8 )
     {
-      error = bmp_08_data_read ( file_in, *width, *height, *rarray );
+      error = bmp_08_data_read ( file_in, width, height, image );
 
       if ( error ) 
 	{
@@ -1295,14 +1247,10 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
 	  cout << "  BMP_08_DATA_READ failed.\n";
 	  return error;
 	}
-
-      *garray = *rarray;
-      *barray = *rarray;
     }
   else if ( bitsperpixel == 24 )
     {
-      error = bmp_24_data_read ( file_in, *width, *height, *rarray, *garray, 
-				 *barray );
+      error = bmp_24_data_read ( file_in, width, height, image );
 
       if ( error ) 
 	{
@@ -1319,19 +1267,13 @@ bool bmp_read ( char *file_in_name, unsigned long int *width, long int *height,
       cout << "  Unrecognized value of BITSPERPIXEL = " << bitsperpixel << "\n";
       return 1;
     }
-  //
-  //  Close the file.
-  //
-  file_in.close ( );
-
   error = false;
   return error;
 }
 
 //****************************************************************************
 
-static bool bmp_24_write ( char *file_out_name, unsigned long int width, long int height, 
-		    unsigned char *rarray, unsigned char *garray, unsigned char *barray )
+static bool bmp_24_write ( char *file_out_name, struct cs1300image *image )
 
   //****************************************************************************
   //
@@ -1350,6 +1292,9 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
   //    Thanks to Tak Fung for suggesting that BMP files should be opened with
   //    the binary option.
   //
+  //    The headers and lines are put together in one large buffer that is
+  //    written out in a few calls.
+  //
   //  Modified:
   // 
   //    02 April 2005
@@ -1378,12 +1323,7 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
   //
   //    Input, char *FILE_OUT_NAME, the name of the output file.
   //
-  //    Input, unsigned long int WIDTH, the X dimension of the image.
-  //
-  //    Input, long int HEIGHT, the Y dimension of the image.
-  //
-  //    Input, unsigned char *RARRAY, *GARRAY, *BARRAY, pointers to the red, green
-  //    and blue color arrays.
+  //    Input, struct cs1300image *IMAGE, the image.
   //
   //    Output, bool BMP_24_WRITE, is true if an error occurred.
   //
@@ -1395,6 +1335,7 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
   unsigned long int colorsimportant;
   unsigned long int colorsused;
   unsigned long int compression;
+  unsigned char *data;
   bool error;
   ofstream file_out;
   unsigned long int filesize;
@@ -1409,6 +1350,8 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
   unsigned long int size = 40;
   unsigned long int sizeofbitmap;
   unsigned long int vertresolution;
+  unsigned long int width = image -> width;
+  long int height = image -> height;
   //
   //  Open the output file.
   //
@@ -1441,8 +1384,15 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
 
   filesize = 54 + ( ( 3 * width ) + padding ) * abs ( height );
   bitmapoffset = 54;
+  //
+  //  The buffer has room for the headers and at least one line.
+  //
+  size_t buffersize = max ( bmp_write_chunk, bitmapoffset + 3 * width + padding );
+  unsigned char *buffer = new unsigned char[buffersize];
 
-  bmp_header1_write ( file_out, filetype, filesize, reserved1, 
+  data = buffer;
+
+  bmp_header1_write ( data, filetype, filesize, reserved1, 
 		      reserved2, bitmapoffset );
   //
   //  Write header 2.
@@ -1456,18 +1406,28 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
   colorsused = 0;
   colorsimportant = 0;
 
-  bmp_header2_write ( file_out, size, width, height, planes, bitsperpixel, 
+  bmp_header2_write ( data, size, width, height, planes, bitsperpixel, 
 		      compression, sizeofbitmap, horzresolution, vertresolution,
 		      colorsused, colorsimportant );
   //
   //  Write the palette.
   //
-  bmp_palette_write ( file_out, colorsused, rparray, gparray, bparray, 
+  bmp_palette_write ( data, colorsused, rparray, gparray, bparray, 
 		      aparray );
   //
   //  Write the data.
   //
-  bmp_24_data_write ( file_out, width, height, rarray, garray, barray );
+  error = bmp_24_data_write ( file_out, image, buffer, buffersize, data );
+
+  delete [] buffer;
+
+  if ( error )
+    {
+      cout << "\n";
+      cout << "BMP_24_WRITE - Fatal error!\n";
+      cout << "  Could not write the output file.\n";
+      return error;
+    }
   //
   //  Close the file.
   //
@@ -1479,13 +1439,13 @@ static bool bmp_24_write ( char *file_out_name, unsigned long int width, long in
 
 //****************************************************************************
 
-static bool long_int_read ( long int *long_int_val, ifstream &file_in )
+static void long_int_read ( long int *long_int_val, const unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    LONG_INT_READ reads a long int from a file.
+  //    LONG_INT_READ reads a long int from a buffer.
   //
   //  Modified:
   //
@@ -1499,56 +1459,37 @@ static bool long_int_read ( long int *long_int_val, ifstream &file_in )
   //
   //    Output, long int *LONG_INT_VAL, the value that was read.
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
-  //
-  //    Output, bool LONG_INT_READ, is true if an error occurred.
+  //    Input/output, const unsigned char *&DATA, the buffer, which is
+  //    advanced past the value.
   //
 {
-  bool error;
   unsigned short int u_short_int_val_hi;
   unsigned short int u_short_int_val_lo;
 
   if ( bmp_byte_swap )
     {
-      error = u_short_int_read ( &u_short_int_val_lo, file_in );
-      if ( error )
-	{
-	  return error;
-	}
-      error = u_short_int_read ( &u_short_int_val_hi, file_in );
-      if ( error )
-	{
-	  return error;
-	}
+      u_short_int_read ( &u_short_int_val_lo, data );
+      u_short_int_read ( &u_short_int_val_hi, data );
     }
   else
     {
-      error = u_short_int_read ( &u_short_int_val_hi, file_in );
-      if ( error )
-	{
-	  return error;
-	}
-      error = u_short_int_read ( &u_short_int_val_lo, file_in );
-      if ( error )
-	{
-	  return error;
-	}
+      u_short_int_read ( &u_short_int_val_hi, data );
+      u_short_int_read ( &u_short_int_val_lo, data );
     }
 
   *long_int_val = ( long int ) 
-    ( u_short_int_val_hi << 16 ) | u_short_int_val_lo;
-
-  return false;
+    ( int ) ( ( u_short_int_val_hi << 16 ) | u_short_int_val_lo );
 }
+
 //****************************************************************************
 
-static void long_int_write ( long int long_int_val, ofstream &file_out )
+static void long_int_write ( long int long_int_val, unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    LONG_INT_WRITE writes a long int to a file.
+  //    LONG_INT_WRITE writes a long int to a buffer.
   //
   //  Modified:
   //
@@ -1562,7 +1503,8 @@ static void long_int_write ( long int long_int_val, ofstream &file_out )
   //
   //    Input, long int *LONG_INT_VAL, the value to be written.
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
 {
   long int temp;
@@ -1585,27 +1527,27 @@ static void long_int_write ( long int long_int_val, ofstream &file_out )
 
   if ( bmp_byte_swap )
     {
-      u_short_int_write ( u_short_int_val_lo, file_out );
-      u_short_int_write ( u_short_int_val_hi, file_out );
+      u_short_int_write ( u_short_int_val_lo, data );
+      u_short_int_write ( u_short_int_val_hi, data );
     }
   else
     {
-      u_short_int_write ( u_short_int_val_hi, file_out );
-      u_short_int_write ( u_short_int_val_lo, file_out );
+      u_short_int_write ( u_short_int_val_hi, data );
+      u_short_int_write ( u_short_int_val_lo, data );
     }
 
   return;
 }
 //****************************************************************************
 
-static bool u_long_int_read ( unsigned long int *u_long_int_val, 
-		       ifstream &file_in )
+static void u_long_int_read ( unsigned long int *u_long_int_val, 
+		       const unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    U_LONG_INT_READ reads an unsigned long int from a file.
+  //    U_LONG_INT_READ reads an unsigned long int from a buffer.
   //
   //  Modified:
   //
@@ -1619,40 +1561,22 @@ static bool u_long_int_read ( unsigned long int *u_long_int_val,
   //
   //    Output, unsigned long int *U_LONG_INT_VAL, the value that was read.
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
-  //
-  //    Output, bool U_LONG_INT_READ, is true if an error occurred.
+  //    Input/output, const unsigned char *&DATA, the buffer, which is
+  //    advanced past the value.
   //
 {
-  bool error;
   unsigned short int u_short_int_val_hi;
   unsigned short int u_short_int_val_lo;
 
   if ( bmp_byte_swap )
     {
-      error = u_short_int_read ( &u_short_int_val_lo, file_in );
-      if ( error )
-	{
-	  return error;
-	}
-      error = u_short_int_read ( &u_short_int_val_hi, file_in );
-      if ( error )
-	{
-	  return error;
-	}
+      u_short_int_read ( &u_short_int_val_lo, data );
+      u_short_int_read ( &u_short_int_val_hi, data );
     }
   else
     {
-      error = u_short_int_read ( &u_short_int_val_hi, file_in );
-      if ( error )
-	{
-	  return error;
-	}
-      error = u_short_int_read ( &u_short_int_val_lo, file_in );
-      if ( error )
-	{
-	  return error;
-	}
+      u_short_int_read ( &u_short_int_val_hi, data );
+      u_short_int_read ( &u_short_int_val_lo, data );
     }
   //
   //  Acknowledgement:
@@ -1661,20 +1585,19 @@ static bool u_long_int_read ( unsigned long int *u_long_int_val,
   //    Peter Kionga-Kamau, 20 May 2000.
   //
 
-  *u_long_int_val = ( u_short_int_val_hi << 16 ) | u_short_int_val_lo;
-
-  return false;
+  *u_long_int_val = ( ( unsigned long int ) u_short_int_val_hi << 16 ) | u_short_int_val_lo;
 }
+
 //****************************************************************************
 
 static void u_long_int_write ( unsigned long int u_long_int_val, 
-			ofstream &file_out )
+			unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    U_LONG_INT_WRITE writes an unsigned long int to a file.
+  //    U_LONG_INT_WRITE writes an unsigned long int to a buffer.
   //
   //  Modified:
   //
@@ -1688,7 +1611,8 @@ static void u_long_int_write ( unsigned long int u_long_int_val,
   //
   //    Input, unsigned long int *U_LONG_INT_VAL, the value to be written.
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
 {
   unsigned short int u_short_int_val_hi;
@@ -1699,27 +1623,27 @@ static void u_long_int_write ( unsigned long int u_long_int_val,
 
   if ( bmp_byte_swap )
     {
-      u_short_int_write ( u_short_int_val_lo, file_out );
-      u_short_int_write ( u_short_int_val_hi, file_out );
+      u_short_int_write ( u_short_int_val_lo, data );
+      u_short_int_write ( u_short_int_val_hi, data );
     }
   else
     {
-      u_short_int_write ( u_short_int_val_hi, file_out );
-      u_short_int_write ( u_short_int_val_lo, file_out );
+      u_short_int_write ( u_short_int_val_hi, data );
+      u_short_int_write ( u_short_int_val_lo, data );
     }
 
   return;
 }
 //****************************************************************************
 
-static bool u_short_int_read ( unsigned short int *u_short_int_val, 
-			ifstream &file_in )
+static void u_short_int_read ( unsigned short int *u_short_int_val, 
+			const unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    U_SHORT_INT_READ reads an unsigned short int from a file.
+  //    U_SHORT_INT_READ reads an unsigned short int from a buffer.
   //
   //  Modified:
   //
@@ -1733,62 +1657,38 @@ static bool u_short_int_read ( unsigned short int *u_short_int_val,
   //
   //    Output, unsigned short int *U_SHORT_INT_VAL, the value that was read.
   //
-  //    Input, ifstream &FILE_IN, a reference to the input file.
-  //
-  //    Output, bool U_SHORT_INT_READ, is true if an error occurred.
+  //    Input/output, const unsigned char *&DATA, the buffer, which is
+  //    advanced past the value.
   //
 {
-  char c;
   unsigned char chi;
   unsigned char clo;
 
   if ( bmp_byte_swap )
     {
-      file_in.read ( &c, 1 );
-      if ( file_in.eof() )
-	{
-	  return true;
-	}
-      clo = ( unsigned char ) c;
-
-      file_in.read ( &c, 1 );
-      if ( file_in.eof() )
-	{
-	  return true;
-	}
-      chi = ( unsigned char ) c;
+      clo = data[0];
+      chi = data[1];
     }
   else
     {
-      file_in.read ( &c, 1 );
-      if ( file_in.eof() )
-	{
-	  return true;
-	}
-      chi = ( unsigned char ) c;
-
-      file_in.read ( &c, 1 );
-      if ( file_in.eof() )
-	{
-	  return true;
-	}
-      clo = ( unsigned char ) c;
+      chi = data[0];
+      clo = data[1];
     }
+  data = data + 2;
 
   *u_short_int_val = ( chi << 8 ) | clo;
-
-  return false;
 }
+
 //****************************************************************************
 
 static void u_short_int_write ( unsigned short int u_short_int_val, 
-			 ofstream &file_out )
+			 unsigned char *&data )
 
   //****************************************************************************
   //
   //  Purpose:
   // 
-  //    U_SHORT_INT_WRITE writes an unsigned short int to a file.
+  //    U_SHORT_INT_WRITE writes an unsigned short int to a buffer.
   //
   //  Modified:
   //
@@ -1802,7 +1702,8 @@ static void u_short_int_write ( unsigned short int u_short_int_val,
   //
   //    Input, unsigned short int *U_SHORT_INT_VAL, the value to be written.
   //
-  //    Input, ofstream &FILE_OUT, a reference to the output file.
+  //    Input/output, unsigned char *&DATA, the output buffer, which is
+  //    advanced past what is written.
   //
 {
   unsigned char chi;
@@ -1813,12 +1714,15 @@ static void u_short_int_write ( unsigned short int u_short_int_val,
 
   if ( bmp_byte_swap )
     {
-      file_out << clo << chi;
+      data[0] = clo;
+      data[1] = chi;
     }
   else
     {
-      file_out << chi << clo;
+      data[0] = chi;
+      data[1] = clo;
     }
+  data = data + 2;
 
   return;
 }
@@ -1829,91 +1733,624 @@ static void u_short_int_write ( unsigned short int u_short_int_val,
 //
 /////////////////////////////////////////////////////////////////////////////
 
+struct cs1300image *
+cs1300image_new(int width, int height)
+{
+  struct cs1300image *image = new struct cs1300image;
+  image -> width = 0;
+  image -> height = 0;
+  image -> stride = 0;
+  for (int plane = 0; plane < MAX_COLORS; plane++) {
+    image -> color[plane] = NULL;
+  }
+  image -> storage = NULL;
+  image -> capacity = 0;
+
+  if ( ! cs1300image_resize(image, width, height) ) {
+    cs1300image_delete(image);
+    return NULL;
+  }
+  return image;
+}
+
 int
-cs1300bmp_readfile(char *filename, struct cs1300bmp *image)
+cs1300image_resize(struct cs1300image *image, int width, int height)
 {
-  bool error;
-  unsigned char *rarray;
-  unsigned char *garray;
-  unsigned char *barray;
+  if ( width < 0 || height < 0 ) {
+    return 0;
+  }
+  //
+  // Round each row up to the alignment so every row starts aligned
+  //
+  size_t rowbytes = (size_t) width * sizeof(cs1300pixel);
+  rowbytes = (rowbytes + CS1300_ROW_ALIGN - 1) & ~(size_t) (CS1300_ROW_ALIGN - 1);
+  size_t planebytes = rowbytes * height;
+  //
+  // One extra aligned block at the end lets vector code load a full
+  // register past the last pixel of the last row
+  //
+  size_t needed = MAX_COLORS * planebytes + CS1300_ROW_ALIGN;
+
+  if ( needed > image -> capacity ) {
+    void *storage;
+    if ( posix_memalign(&storage, CS1300_ROW_ALIGN, needed) != 0 ) {
+      return 0;
+    }
+    free(image -> storage);
+    image -> storage = storage;
+    image -> capacity = needed;
+  }
+
+  image -> width = width;
+  image -> height = height;
+  image -> stride = rowbytes / sizeof(cs1300pixel);
+  for (int plane = 0; plane < MAX_COLORS; plane++) {
+    image -> color[plane] = (cs1300pixel *) ((char *) image -> storage + plane * planebytes);
+  }
+  return 1;
+}
+
+void
+cs1300image_delete(struct cs1300image *image)
+{
+  if ( image ) {
+    free(image -> storage);
+    delete image;
+  }
+}
+
+int
+cs1300image_readfile(char *filename, struct cs1300image *image)
+{
+  ifstream file_in ( filename, ios::in | ios::binary );
+  //
+  //  Read the data from file straight into the planes.
+  //
+  bool error = bmp_read ( file_in, image );
+
+  return error ? 0 : 1;
+}
+
+int
+cs1300image_readfd(int fd, struct cs1300image *image)
+{
+  //
+  // The buffer closes the descriptor it reads, so it gets a copy; the
+  // copy shares the offset, which is put back at the start
+  //
+  int copy = dup ( fd );
+  if ( copy < 0 || lseek ( copy, 0, SEEK_SET ) != 0 ) {
+    cout << "\n";
+    cout << "CS1300IMAGE_READFD - Fatal error!\n";
+    cout << "  Could not read the input file.\n";
+    if ( copy >= 0 ) {
+      close ( copy );
+    }
+    return 0;
+  }
+  __gnu_cxx::stdio_filebuf<char> buffer ( copy, ios::in | ios::binary );
+  istream file_in ( &buffer );
+  bool error = bmp_read ( file_in, image );
+
+  return error ? 0 : 1;
+}
 
-  long int height;
-  unsigned long int width;
 
-  rarray = NULL;
-  garray = NULL;
-  barray = NULL;
+int
+cs1300image_writefile(char *filename, struct cs1300image *image)
+{
+  bool error = bmp_24_write ( filename, image );
+
+  return error ? 0 : 1;
+}
+
+
+int
+cs1300view_open(char *filename, struct cs1300view *view)
+{
+  view -> map = NULL;
+  view -> maplength = 0;
+
+  int fd = open(filename, O_RDONLY);
+  if ( fd < 0 ) {
+    cout << "\n";
+    cout << "CS1300VIEW_OPEN - Fatal error!\n";
+    cout << "  Could not open the input file.\n";
+    return 0;
+  }
+
+  struct stat info;
+  if ( fstat(fd, &info) != 0 || info.st_size < 54 ) {
+    cout << "\n";
+    cout << "CS1300VIEW_OPEN - Fatal error!\n";
+    cout << "  The file is too short to be a BMP file.\n";
+    close(fd);
+    return 0;
+  }
+
+  size_t length = info.st_size;
+  void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if ( map == MAP_FAILED ) {
+    cout << "\n";
+    cout << "CS1300VIEW_OPEN - Fatal error!\n";
+    cout << "  Could not map the input file.\n";
+    return 0;
+  }
+  madvise(map, length, MADV_SEQUENTIAL);
   //
-  //  Read the data from file.
+  // Check the headers. Only uncompressed 24-bit images can be used in
+  // place; anything else has to go through cs1300image_readfile.
   //
-  error = bmp_read ( filename, &width, &height,
-		     &rarray, &garray, &barray );
-  if ( error ) {
+  const unsigned char *data = (const unsigned char *) map;
+  unsigned short int filetype, reserved, planes, bitsperpixel;
+  unsigned long int filesize, bitmapoffset, size, width, compression;
+  long int height;
+
+  filetype = data[0] * 256 + data[1];
+  data = data + 2;
+  u_long_int_read ( &filesize, data );
+  u_short_int_read ( &reserved, data );
+  u_short_int_read ( &reserved, data );
+  u_long_int_read ( &bitmapoffset, data );
+  u_long_int_read ( &size, data );
+  u_long_int_read ( &width, data );
+  long_int_read ( &height, data );
+  u_short_int_read ( &planes, data );
+  u_short_int_read ( &bitsperpixel, data );
+  u_long_int_read ( &compression, data );
+
+  long int lines = abs ( height );
+  size_t linebytes = 3 * width + ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
+  const char *problem = NULL;
+
+  if ( filetype != 'B' * 256 + 'M' ) {
+    problem = "The file's internal magic number is not \"BM\".";
+  } else if ( bitsperpixel != 24 || compression != 0 ) {
+    problem = "Only uncompressed 24-bit images can be mapped.";
+  } else if ( width == 0 || 0x7fffffff < width || lines == 0 || 0x7fffffff < lines ) {
+    problem = "The image size is not usable.";
+  } else if ( length < bitmapoffset
+	      || length - bitmapoffset < ( lines - 1 ) * linebytes + 3 * width ) {
     //
-    //  Free the memory.
+    // The last line may be missing its padding, as bmp_read allows
     //
-    delete [] rarray;
-    delete [] garray;
-    delete [] barray;
+    problem = "The file is shorter than its pixel data.";
+  }
+
+  if ( problem ) {
+    cout << "\n";
+    cout << "CS1300VIEW_OPEN - Fatal error!\n";
+    cout << "  " << problem << "\n";
+    munmap(map, length);
     return 0;
+  }
+
+  const unsigned char *first = (const unsigned char *) map + bitmapoffset;
+
+  view -> width = width;
+  view -> height = lines;
+  if ( height < 0 ) {
+    view -> stride = - (long) linebytes;
+    view -> pixels = first + ( lines - 1 ) * linebytes;
   } else {
+    view -> stride = linebytes;
+    view -> pixels = first;
+  }
+  view -> map = map;
+  view -> maplength = length;
+  return 1;
+}
+
+void
+cs1300view_close(struct cs1300view *view)
+{
+  if ( view -> map ) {
+    munmap(view -> map, view -> maplength);
+    view -> map = NULL;
+    view -> maplength = 0;
+  }
+}
+
+long long
+cs1300bmp_convertticks(void)
+{
+  return convert_ticks;
+}
+
+int
+cs1300stream_openread(char *filename, struct cs1300stream *stream)
+{
+  ifstream *file = new ifstream(filename, ios::in | ios::binary);
+  const char *problem = NULL;
+  unsigned short int filetype, reserved1, reserved2, planes, bitsperpixel;
+  unsigned long int filesize, bitmapoffset, size, width, compression, sizeofbitmap;
+  unsigned long int horzresolution, vertresolution, colorsused, colorsimportant;
+  long int height;
+
+  if ( !*file ) {
+    problem = "Could not open the input file.";
+  } else if ( bmp_header1_read ( *file, &filetype, &filesize, &reserved1, &reserved2, &bitmapoffset )
+	      || bmp_header2_read ( *file, &size, &width, &height, &planes, &bitsperpixel,
+				    &compression, &sizeofbitmap, &horzresolution, &vertresolution,
+				    &colorsused, &colorsimportant ) ) {
+    problem = "Could not read the headers.";
+  } else if ( filetype != 'B' * 256 + 'M' ) {
+    problem = "The file's internal magic number is not \"BM\".";
+  } else if ( bitsperpixel != 24 || compression != 0 ) {
+    problem = "Only uncompressed 24-bit images can be streamed.";
+  } else if ( width == 0 || 0x7fffffff < width || height == 0 || 0x7fffffff < abs ( height ) ) {
+    problem = "The image size is not usable.";
+  }
+
+  if ( problem ) {
+    cout << "\n";
+    cout << "CS1300STREAM_OPENREAD - Fatal error!\n";
+    cout << "  " << problem << "\n";
+    delete file;
+    return 0;
+  }
+
+  stream -> width = width;
+  stream -> height = abs ( height );
+  stream -> row = 0;
+  stream -> file = file;
+  stream -> linebytes = 3 * width + ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
+  stream -> line = new unsigned char[stream -> linebytes];
+  stream -> bitmapoffset = bitmapoffset;
+  stream -> topdown = height < 0;
+  stream -> writing = 0;
+  stream -> failed = 0;
+  file -> seekg ( bitmapoffset, ios::beg );
+  return 1;
+}
+
+int
+cs1300stream_openwrite(char *filename, int width, int height, struct cs1300stream *stream)
+{
+  ofstream *file = new ofstream(filename, ios::out | ios::binary);
+  if ( !*file ) {
+    cout << "\n";
+    cout << "CS1300STREAM_OPENWRITE - Fatal error!\n";
+    cout << "  Could not open the output file.\n";
+    delete file;
+    return 0;
+  }
+
+  //
+  // The same headers bmp_24_write makes
+  //
+  size_t linebytes = 3 * width + ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
+  unsigned char header[54];
+  unsigned char *data = header;
+  bmp_header1_write ( data, bmp_byte_swap ? 'M' * 256 + 'B' : 'B' * 256 + 'M',
+		      54 + linebytes * height, 0, 0, 54 );
+  bmp_header2_write ( data, 40, width, height, 1, 24, 0, 0, 0, 0, 0, 0 );
+  file -> write ( ( char * ) header, sizeof ( header ) );
+
+  stream -> width = width;
+  stream -> height = height;
+  stream -> row = 0;
+  stream -> file = file;
+  stream -> linebytes = linebytes;
+  stream -> line = new unsigned char[linebytes];
+  memset ( stream -> line, 0, linebytes );
+  stream -> bitmapoffset = 54;
+  stream -> topdown = 0;
+  stream -> writing = 1;
+  stream -> failed = !*file;
+  return 1;
+}
+
+int
+cs1300stream_readline(struct cs1300stream *stream, cs1300pixel *const *planes)
+{
+  ifstream *file = (ifstream *) stream -> file;
+  int padding = stream -> linebytes - 3 * stream -> width;
+  bool last;
+
+  if ( stream -> row >= stream -> height ) {
+    return 0;
+  }
+  if ( stream -> topdown ) {
     //
-    // Copy the image from the flat representation to the array used for cs1300
+    // Bottom line first means last line of the file first
     //
-    image -> width = width;
-    image -> height = height;
-    for (int row = 0; row < height; row ++ ) {
-      for (unsigned int col = 0; col < width; col ++ ) {
-	image -> color[COLOR_RED  ][row][col] = rarray[row * width + col];
-	image -> color[COLOR_GREEN][row][col] = garray[row * width + col];
-	image -> color[COLOR_BLUE ][row][col] = barray[row * width + col];
-      }
+    file -> clear ( );
+    file -> seekg ( stream -> bitmapoffset
+		    + ( stream -> height - 1 - stream -> row ) * stream -> linebytes, ios::beg );
+    last = stream -> row == 0;
+  } else {
+    last = stream -> row == stream -> height - 1;
+  }
+  if ( bmp_data_chunk_read ( *file, stream -> line, stream -> linebytes, padding, last,
+			     "CS1300STREAM_READLINE" ) ) {
+    return 0;
+  }
+
+  const unsigned char *line = stream -> line;
+  cs1300pixel *red = planes[COLOR_RED];
+  cs1300pixel *green = planes[COLOR_GREEN];
+  cs1300pixel *blue = planes[COLOR_BLUE];
+  for (int i = 0; i < stream -> width; i++) {
+    blue[i] = line[3 * i];
+    green[i] = line[3 * i + 1];
+    red[i] = line[3 * i + 2];
+  }
+  stream -> row++;
+  return 1;
+}
+
+int
+cs1300stream_writeline(struct cs1300stream *stream, const cs1300pixel *const *planes)
+{
+  ofstream *file = (ofstream *) stream -> file;
+  unsigned char *line = stream -> line;
+  const cs1300pixel *red = planes[COLOR_RED];
+  const cs1300pixel *green = planes[COLOR_GREEN];
+  const cs1300pixel *blue = planes[COLOR_BLUE];
+
+  for (int i = 0; i < stream -> width; i++) {
+    line[3 * i] = blue[i];
+    line[3 * i + 1] = green[i];
+    line[3 * i + 2] = red[i];
+  }
+  file -> write ( ( char * ) line, stream -> linebytes );
+  stream -> failed = stream -> failed || !*file;
+  stream -> row++;
+  return !stream -> failed;
+}
+
+int
+cs1300stream_close(struct cs1300stream *stream)
+{
+  int ok = !stream -> failed;
+  if ( stream -> writing ) {
+    ofstream *file = (ofstream *) stream -> file;
+    file -> close ( );
+    ok = ok && !file -> fail ( );
+    delete file;
+  } else {
+    delete (ifstream *) stream -> file;
+  }
+  delete [] stream -> line;
+  stream -> file = NULL;
+  stream -> line = NULL;
+  return ok;
+}
+
+struct cs1300packed *
+cs1300packed_new(int width, int height)
+{
+  struct cs1300packed *image = new struct cs1300packed;
+  image -> width = 0;
+  image -> height = 0;
+  image -> stride = 0;
+  image -> pixels = NULL;
+  image -> storage = NULL;
+  image -> capacity = 0;
+
+  if ( ! cs1300packed_resize(image, width, height) ) {
+    cs1300packed_delete(image);
+    return NULL;
+  }
+  return image;
+}
+
+int
+cs1300packed_resize(struct cs1300packed *image, int width, int height)
+{
+  if ( width < 0 || height < 0 ) {
+    return 0;
+  }
+  size_t linebytes = 3 * ( size_t ) width + ( 4 - ( ( 3 * width ) % 4 ) ) % 4;
+  //
+  // The same slack at the end as a cs1300image
+  //
+  size_t needed = linebytes * height + CS1300_ROW_ALIGN;
+
+  if ( needed > image -> capacity ) {
+    void *storage;
+    if ( posix_memalign(&storage, CS1300_ROW_ALIGN, needed) != 0 ) {
+      return 0;
     }
+    free(image -> storage);
+    image -> storage = storage;
+    image -> capacity = needed;
+  }
+
+  image -> width = width;
+  image -> height = height;
+  image -> stride = linebytes;
+  image -> pixels = ( unsigned char * ) image -> storage;
+  return 1;
+}
+
+void
+cs1300packed_delete(struct cs1300packed *image)
+{
+  if ( image ) {
+    free(image -> storage);
+    delete image;
+  }
+}
+
+int
+cs1300packed_readfile(char *filename, struct cs1300packed *image)
+{
+  ifstream file(filename, ios::in | ios::binary);
+  const char *problem = NULL;
+  unsigned short int filetype, reserved1, reserved2, planes, bitsperpixel;
+  unsigned long int filesize, bitmapoffset, size, width, compression, sizeofbitmap;
+  unsigned long int horzresolution, vertresolution, colorsused, colorsimportant;
+  long int height;
+
+  if ( !file ) {
+    problem = "Could not open the input file.";
+  } else if ( bmp_header1_read ( file, &filetype, &filesize, &reserved1, &reserved2, &bitmapoffset )
+	      || bmp_header2_read ( file, &size, &width, &height, &planes, &bitsperpixel,
+				    &compression, &sizeofbitmap, &horzresolution, &vertresolution,
+				    &colorsused, &colorsimportant ) ) {
+    problem = "Could not read the headers.";
+  } else if ( filetype != 'B' * 256 + 'M' ) {
+    problem = "The file's internal magic number is not \"BM\".";
+  } else if ( width == 0 || 0x7fffffff < width || height == 0 || 0x7fffffff < abs ( height ) ) {
+    problem = "The image size is not usable.";
+  }
+
+  if ( problem ) {
+    cout << "\n";
+    cout << "CS1300PACKED_READFILE - Fatal error!\n";
+    cout << "  " << problem << "\n";
+    return 0;
+  }
+
+  long int lines = abs ( height );
+  if ( bitsperpixel != 24 || compression != 0 ) {
     //
-    //  Free the memory.
+    // Anything but plain 24-bit data is decoded into planes and packed
     //
-    delete [] rarray;
-    delete [] garray;
-    delete [] barray;
+    file.close ( );
+    struct cs1300image *planar = cs1300image_new ( 0, 0 );
+    int ok = planar && cs1300image_readfile ( filename, planar )
+      && cs1300packed_resize ( image, planar -> width, planar -> height );
+    for ( int row = 0; ok && row < image -> height; row++ )
+      {
+	unsigned char *line = cs1300packed_row ( image, row );
+	const cs1300pixel *red = cs1300image_row ( planar, COLOR_RED, row );
+	const cs1300pixel *green = cs1300image_row ( planar, COLOR_GREEN, row );
+	const cs1300pixel *blue = cs1300image_row ( planar, COLOR_BLUE, row );
+	for ( int i = 0; i < image -> width; i++ )
+	  {
+	    line[3 * i] = blue[i];
+	    line[3 * i + 1] = green[i];
+	    line[3 * i + 2] = red[i];
+	  }
+      }
+    cs1300image_delete ( planar );
+    return ok;
+  }
 
+  if ( ! cs1300packed_resize ( image, width, lines ) ) {
+    return 0;
+  }
+  size_t linebytes = image -> stride;
+  file.seekg ( bitmapoffset, ios::beg );
+  if ( bmp_data_chunk_read ( file, image -> pixels, linebytes * lines, linebytes - 3 * width,
+			     true, "CS1300PACKED_READFILE" ) ) {
+    return 0;
+  }
+  if ( height < 0 ) {
     //
-    // Success
+    // Stored top line first: turn the rows over in place
     //
-    return( 1 );
+    unsigned char *swap = new unsigned char[linebytes];
+    for ( long int row = 0; row < lines / 2; row++ )
+      {
+	unsigned char *top = cs1300packed_row ( image, row );
+	unsigned char *bottom = cs1300packed_row ( image, lines - 1 - row );
+	memcpy ( swap, top, linebytes );
+	memcpy ( top, bottom, linebytes );
+	memcpy ( bottom, swap, linebytes );
+      }
+    delete [] swap;
   }
-  
+  return 1;
 }
 
 int
-cs1300bmp_writefile(char *filename, struct cs1300bmp *image)
+cs1300packed_writefile(char *filename, struct cs1300packed *image)
 {
-  int colorbytes = image -> width * image -> height;
-
-  unsigned char *rarray = new unsigned char[colorbytes];
-  unsigned char *garray = new unsigned char[colorbytes];
-  unsigned char *barray = new unsigned char[colorbytes];
-  
-  int height = image -> height;
-  int width  = image -> width;
-  for (int row = 0; row < height; row ++ ) {
-    for (int col = 0; col < width; col ++ ) {
-      rarray[row * width + col] = image -> color[COLOR_RED  ][row][col];
-      garray[row * width + col] = image -> color[COLOR_GREEN][row][col];
-      barray[row * width + col] = image -> color[COLOR_BLUE ][row][col];
+  ofstream file(filename, ios::out | ios::binary);
+  if ( !file ) {
+    cout << "\n";
+    cout << "CS1300PACKED_WRITEFILE - Fatal error!\n";
+    cout << "  Could not open the output file.\n";
+    return 0;
+  }
+
+  size_t linebytes = image -> stride;
+  size_t padding = linebytes - 3 * image -> width;
+  for ( int row = 0; padding && row < image -> height; row++ )
+    {
+      memset ( cs1300packed_row ( image, row ) + 3 * image -> width, 0, padding );
     }
+
+  //
+  // The same headers bmp_24_write makes
+  //
+  unsigned char header[54];
+  unsigned char *data = header;
+  bmp_header1_write ( data, bmp_byte_swap ? 'M' * 256 + 'B' : 'B' * 256 + 'M',
+		      54 + linebytes * image -> height, 0, 0, 54 );
+  bmp_header2_write ( data, 40, image -> width, image -> height, 1, 24, 0, 0, 0, 0, 0, 0 );
+  file.write ( ( char * ) header, sizeof ( header ) );
+  file.write ( ( char * ) image -> pixels, linebytes * image -> height );
+  file.close ( );
+  return !file.fail ( );
+}
+
+void
+cs1300packed_view(struct cs1300packed *image, struct cs1300view *view)
+{
+  view -> width = image -> width;
+  view -> height = image -> height;
+  view -> stride = image -> stride;
+  view -> pixels = image -> pixels;
+  view -> map = NULL;
+  view -> maplength = 0;
+}
+
+//
+// The fixed size struct goes through a cs1300image so there is only
+// one copy of the BMP code to maintain.
+//
+
+int
+cs1300bmp_readfile(char *filename, struct cs1300bmp *image)
+{
+  struct cs1300image *flex = cs1300image_new(0, 0);
+  int ok = flex && cs1300image_readfile(filename, flex);
+
+  if ( ok && (flex -> width > MAX_DIM || flex -> height > MAX_DIM) ) {
+    cout << "\n";
+    cout << "CS1300BMP_READFILE: Fatal error!\n";
+    cout << "  Image is larger than " << MAX_DIM << " x " << MAX_DIM << ".\n";
+    ok = 0;
   }
-  
-  int error = bmp_24_write ( filename, image -> width, image -> height,
-			     rarray, garray, barray );
-  
-  delete [] rarray;
-  delete [] garray;
-  delete [] barray;
-
-  if ( error ) {
-    return 0;
-  } else {
-    return 1;
+  if ( ok ) {
+    image -> width = flex -> width;
+    image -> height = flex -> height;
+    for (int plane = 0; plane < MAX_COLORS; plane++) {
+      for (int row = 0; row < flex -> height; row ++ ) {
+	cs1300pixel *src = cs1300image_row(flex, plane, row);
+	for (int col = 0; col < flex -> width; col ++ ) {
+	  image -> color[plane][row][col] = src[col];
+	}
+      }
+    }
   }
+  cs1300image_delete(flex);
+  return ok;
 }
 
+int
+cs1300bmp_writefile(char *filename, struct cs1300bmp *image)
+{
+  struct cs1300image *flex = cs1300image_new(image -> width, image -> height);
+  if ( ! flex ) {
+    return 0;
+  }
+  for (int plane = 0; plane < MAX_COLORS; plane++) {
+    for (int row = 0; row < image -> height; row ++ ) {
+      cs1300pixel *dst = cs1300image_row(flex, plane, row);
+      for (int col = 0; col < image -> width; col ++ ) {
+	dst[col] = image -> color[plane][row][col];
+      }
+    }
+  }
+  int ok = cs1300image_writefile(filename, flex);
+  cs1300image_delete(flex);
+  return ok;
+}
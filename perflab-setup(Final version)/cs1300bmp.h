@@ -2,8 +2,11 @@
 #ifndef _cs1300bmp_h_
 #define _cs1300bmp_h_
 
+#include <stddef.h>
+
 //
-// Maximum image size
+// Largest image the fixed size struct cs1300bmp holds; cs1300image and
+// cs1300stream take any size
 //
 #define MAX_DIM 8192
 
@@ -15,6 +18,11 @@
 #define COLOR_BLUE 2
 #define MAX_COLORS 3
 
+//
+// Fixed size image. Each one reserves room for a MAX_DIM x MAX_DIM
+// image (768MB), so new code should use cs1300image below; this is
+// kept so older programs still build.
+//
 struct cs1300bmp {
   //
   // Actual width used by this image
@@ -26,10 +34,119 @@ struct cs1300bmp {
   int height;
   //
   // R/G/B fields
-  // 
+  //
   int color[MAX_COLORS][MAX_DIM][MAX_DIM];
 };
 
+//
+// Type used to store one color sample. BMP samples are bytes, so that
+// is the default; build with -DCS1300_PIXEL_TYPE=int to get int planes
+// like the old struct. Filters always accumulate in cs1300accum.
+//
+#ifndef CS1300_PIXEL_TYPE
+#define CS1300_PIXEL_TYPE unsigned char
+#endif
+
+typedef CS1300_PIXEL_TYPE cs1300pixel;
+typedef int cs1300accum;
+
+//
+// Every row of a cs1300image starts on this byte boundary, so vector
+// loads of a row are aligned for SSE, AVX2 and AVX-512 alike.
+//
+#define CS1300_ROW_ALIGN 64
+
+//
+// Image whose size is set at runtime. Pixels are stored as three
+// planes, one per color; row r of a plane starts at color[plane] +
+// r * stride. The storage is reused when an image is resized to
+// something no larger than what it has held before.
+//
+struct cs1300image {
+  int width;
+  int height;
+  //
+  // Distance between the starts of consecutive rows, in pixels
+  //
+  int stride;
+  //
+  // R/G/B planes
+  //
+  cs1300pixel *color[MAX_COLORS];
+  //
+  // Backing storage for all the planes and its size in bytes
+  //
+  void *storage;
+  size_t capacity;
+};
+
+//
+// Read-only view of the pixels of a 24-bit BMP file mapped straight
+// from disk. Pixels stay interleaved as the file stores them (blue,
+// green, red); row r starts at pixels + r * stride bytes. Rows are
+// bottom line first like cs1300image, so stride is negative for files
+// stored top line first.
+//
+struct cs1300view {
+  int width;
+  int height;
+  long stride;
+  const unsigned char *pixels;
+  //
+  // The mapping itself
+  //
+  void *map;
+  size_t maplength;
+};
+
+//
+// A 24-bit BMP file read or written one line at a time, bottom line
+// first, so an image of any size needs only a line of memory. Files
+// stored top line first can be read too; files are always written
+// bottom line first, as cs1300image_writefile does.
+//
+struct cs1300stream {
+  int width;
+  int height;
+  //
+  // Next line to read or write
+  //
+  int row;
+  //
+  // The open file, and a buffer for one line of it with its padding
+  //
+  void *file;
+  unsigned char *line;
+  size_t linebytes;
+  unsigned long bitmapoffset;
+  int topdown;
+  int writing;
+  int failed;
+};
+
+//
+// An image kept the way a 24-bit BMP file keeps it: blue, green and red
+// samples interleaved, rows bottom line first, each padded to a
+// multiple of 4 bytes. Reading and writing one is a single block with
+// no conversion, and it can be filtered through a cs1300view.
+//
+struct cs1300packed {
+  int width;
+  int height;
+  //
+  // Distance between the starts of consecutive rows, in bytes
+  //
+  long stride;
+  unsigned char *pixels;
+  void *storage;
+  size_t capacity;
+};
+
+//
+// Byte offset of a color within an interleaved pixel
+//
+#define CS1300VIEW_OFFSET(plane) (2 - (plane))
+
 //
 // routines to read and write BMP images
 //
@@ -41,9 +158,95 @@ extern "C" {
 int cs1300bmp_readfile(char *filename, struct cs1300bmp *image);
 int cs1300bmp_writefile(char *filename, struct cs1300bmp *image);
 
+struct cs1300image *cs1300image_new(int width, int height);
+int cs1300image_resize(struct cs1300image *image, int width, int height);
+void cs1300image_delete(struct cs1300image *image);
+
+int cs1300image_readfile(char *filename, struct cs1300image *image);
+//
+// The same from the open file FD, read from its start; FD is left open
+//
+int cs1300image_readfd(int fd, struct cs1300image *image);
+int cs1300image_writefile(char *filename, struct cs1300image *image);
+//
+// Ticks the calling thread has spent so far in those two converting
+// file lines to planes and back, as opposed to reading and writing
+//
+long long cs1300bmp_convertticks(void);
+
+int cs1300view_open(char *filename, struct cs1300view *view);
+void cs1300view_close(struct cs1300view *view);
+
+struct cs1300packed *cs1300packed_new(int width, int height);
+int cs1300packed_resize(struct cs1300packed *image, int width, int height);
+void cs1300packed_delete(struct cs1300packed *image);
+int cs1300packed_readfile(char *filename, struct cs1300packed *image);
+//
+// Writes IMAGE, clearing the padding at the end of each row first
+//
+int cs1300packed_writefile(char *filename, struct cs1300packed *image);
+//
+// A view of IMAGE for code that reads mapped files; it must not be
+// closed
+//
+void cs1300packed_view(struct cs1300packed *image, struct cs1300view *view);
+
+int cs1300stream_openread(char *filename, struct cs1300stream *stream);
+int cs1300stream_openwrite(char *filename, int width, int height, struct cs1300stream *stream);
+//
+// The next line, with planes[COLOR_RED] and so on each width samples
+//
+int cs1300stream_readline(struct cs1300stream *stream, cs1300pixel *const *planes);
+int cs1300stream_writeline(struct cs1300stream *stream, const cs1300pixel *const *planes);
+//
+// Returns 0 if any line could not be written
+//
+int cs1300stream_close(struct cs1300stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
 
+//
+// Start of a row in one of the planes
+//
+static inline cs1300pixel *
+cs1300image_row(struct cs1300image *image, int plane, int row)
+{
+  return image -> color[plane] + (size_t) row * image -> stride;
+}
+
+//
+// Start of a row of a mapped file
+//
+static inline const unsigned char *
+cs1300view_row(const struct cs1300view *view, int row)
+{
+  return view -> pixels + row * view -> stride;
+}
+
+//
+// Start of a row of a packed image
+//
+static inline unsigned char *
+cs1300packed_row(struct cs1300packed *image, int row)
+{
+  return image -> pixels + row * image -> stride;
+}
+
+#ifdef __cplusplus
+//
+// Let C++ callers use the usual names on the new image type
+//
+inline int cs1300bmp_readfile(char *filename, struct cs1300image *image)
+{
+  return cs1300image_readfile(filename, image);
+}
+
+inline int cs1300bmp_writefile(char *filename, struct cs1300image *image)
+{
+  return cs1300image_writefile(filename, image);
+}
+#endif
 
 #endif
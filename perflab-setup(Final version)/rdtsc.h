@@ -15,4 +15,18 @@ unsigned long long int rdtscll(void)
    return ((unsigned long long)a) | (((unsigned long long)d) << 32);;
 }
 
+//
+// The same, but read only once every earlier instruction has finished
+// (rdtscp), so work started before it cannot be counted after it
+//
+inline
+unsigned long long int rdtscpll(void)
+{
+   unsigned a, d, c;
+
+   __asm__ volatile("rdtscp" : "=a" (a), "=d" (d), "=c" (c));
+
+   return ((unsigned long long)a) | (((unsigned long long)d) << 32);
+}
+
 #endif